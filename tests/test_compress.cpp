@@ -0,0 +1,178 @@
+#include <stdio.h>
+#include "tests.h"
+#include "uwsav/uwsav_compress.h"
+#include "uwsav/uwsav_data.h"
+#include "utils/sharedfilestream.h"
+
+// Compression levels to check; the encoder takes different paths at 0,
+// without lazy matching, and with it
+static const int TestLevels[] = { 0, 1, 3, 6, 9 };
+
+// Small deterministic generator of the test data
+struct TestRandom
+{
+    uint32_t State = 0x9E3779B9u;
+
+    uint8_t Next()
+    {
+        State ^= State << 13;
+        State ^= State >> 17;
+        State ^= State << 5;
+        return static_cast<uint8_t>(State >> 24);
+    }
+};
+
+static std::string Describe(const char *name, int level, const char *how)
+{
+    char buf[320];
+    if (level >= 0)
+        snprintf(buf, sizeof(buf), "%s, level %d, %s", name, level, how);
+    else
+        snprintf(buf, sizeof(buf), "%s, %s", name, how);
+    return buf;
+}
+
+// Decodes the block piece by piece with UW2BlockDecoder
+static void DecodeIncremental(const std::vector<uint8_t> &packed, std::vector<uint8_t> &out)
+{
+    out.clear();
+    UW2BlockDecoder decoder(packed.data(), packed.size());
+    const uint8_t *piece;
+    for (size_t size; (size = decoder.Decode(piece)) > 0; )
+        out.insert(out.end(), piece, piece + size);
+}
+
+// Encodes the data with each level, and with the given encoder, which has
+// encoded other data before; checks that decoding gives the data back
+static void CheckRoundTrip(const char *name, const std::vector<uint8_t> &data,
+                           UW2BlockEncoder *reused = nullptr)
+{
+    for (int level : TestLevels)
+    {
+        std::vector<uint8_t> packed;
+        TEST_CHECK(CompressUW2Block(data.data(), data.size(), packed, level), Describe(name, level, "compress"));
+        std::vector<uint8_t> unpacked;
+        UncompressUW2Block(packed.data(), packed.size(), unpacked);
+        TEST_CHECK(unpacked == data, Describe(name, level, "uncompress"));
+        DecodeIncremental(packed, unpacked);
+        TEST_CHECK(unpacked == data, Describe(name, level, "incremental decode"));
+    }
+
+    // The tables left from the previous blocks must not affect the matches
+    if (reused)
+    {
+        std::vector<uint8_t> packed, unpacked;
+        reused->Encode(data.data(), data.size(), packed);
+        UncompressUW2Block(packed.data(), packed.size(), unpacked);
+        TEST_CHECK(unpacked == data, Describe(name, -1, "reused encoder"));
+    }
+}
+
+static void CheckSynthetic()
+{
+    TestRandom rnd;
+    UW2BlockEncoder reused(UW2BlockEncoder::MaxLevel);
+    std::vector<uint8_t> data;
+
+    CheckRoundTrip("empty", data);
+    data.assign(1, 0x5A);
+    CheckRoundTrip("one byte", data);
+    data.assign(UW2BlockEncoder::MinCopy - 1, 0x5A);
+    CheckRoundTrip("shorter than a copy", data);
+
+    // Long runs are encoded as copies which overlap their source
+    data.assign(100000, 0u);
+    CheckRoundTrip("zeros", data, &reused);
+    std::vector<uint8_t> packed;
+    CompressUW2Block(data.data(), data.size(), packed, UW2BlockEncoder::DefaultLevel);
+    TEST_CHECK(packed.size() < data.size() / 4, "zeros must compress");
+    data.clear();
+    for (size_t run = 1; data.size() < 60000; run = run % 40 + 1)
+        data.insert(data.end(), run, rnd.Next());
+    CheckRoundTrip("runs", data, &reused);
+    data.clear();
+    for (size_t i = 0; i < 30000; ++i)
+        data.push_back(static_cast<uint8_t>("abcab"[i % 5]));
+    CheckRoundTrip("short pattern", data, &reused);
+
+    // No matches at all
+    data.clear();
+    for (size_t i = 0; i < 20000; ++i)
+        data.push_back(rnd.Next());
+    CheckRoundTrip("random", data, &reused);
+
+    // Repeats at the window size and around it: the data which is exactly
+    // a window away may be copied, the data farther away may not; the
+    // window position wraps over many times
+    const size_t window = UW2BlockDecoder::WindowSize;
+    const size_t distances[] = { window - 1, window, window + 1, window + UW2BlockEncoder::MaxCopy };
+    for (size_t distance : distances)
+    {
+        std::vector<uint8_t> chunk;
+        for (size_t i = 0; i < distance; ++i)
+            chunk.push_back(rnd.Next());
+        data.clear();
+        for (size_t i = 0; i < 8; ++i)
+            data.insert(data.end(), chunk.begin(), chunk.end());
+        char name[64];
+        snprintf(name, sizeof(name), "repeats at distance %u", static_cast<unsigned>(distance));
+        CheckRoundTrip(name, data, &reused);
+    }
+
+    // Random data mixed with the copies of its recent parts
+    data.clear();
+    while (data.size() < 50000)
+    {
+        const size_t literals = rnd.Next() % 24;
+        for (size_t i = 0; i < literals; ++i)
+            data.push_back(rnd.Next() & 0x0F);
+        const size_t distance = 1 + (static_cast<size_t>(rnd.Next()) << 4) % window;
+        const size_t count = rnd.Next() % 32;
+        for (size_t i = 0; i < count && distance <= data.size(); ++i)
+            data.push_back(data[data.size() - distance]);
+    }
+    CheckRoundTrip("mixed", data, &reused);
+}
+
+// Re-encodes the UW2 level blocks of the archive, compressed or not
+static void CheckArchive(const std::string &path)
+{
+    Stream in(SharedFileStream::TryOpen(path));
+    GameType game;
+    if (!in || !DetectGameType(in, game))
+    {
+        TEST_CHECK(false, "failed to open " + path);
+        return;
+    }
+    if (game != kGameUW2)
+    {
+        printf("%s: not a UW2 archive, skipped\n", path.c_str());
+        return;
+    }
+    std::vector<LevelBlockInfo> level_blocks;
+    ReadLevelDirectory(in, game, level_blocks);
+    TEST_CHECK(!level_blocks.empty(), "no levels in " + path);
+    UW2BlockEncoder reused;
+    for (const auto &level_block : level_blocks)
+    {
+        const DataBlockInfo &block = level_block.Block;
+        std::vector<uint8_t> raw(block.Size);
+        in.Seek(block.Offset, kSeekBegin);
+        raw.resize(in.Read(raw.data(), raw.size()));
+        std::vector<uint8_t> data;
+        if (block.IsCompressed)
+            UncompressUW2Block(raw.data(), raw.size(), data);
+        else
+            data.swap(raw);
+        char name[256];
+        snprintf(name, sizeof(name), "%s, block %u", path.c_str(), static_cast<unsigned>(block.Index));
+        CheckRoundTrip(name, data, &reused);
+    }
+}
+
+void TestCompress(const std::vector<std::string> &archives)
+{
+    CheckSynthetic();
+    for (const auto &path : archives)
+        CheckArchive(path);
+}
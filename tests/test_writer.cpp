@@ -0,0 +1,300 @@
+#include <stdio.h>
+#include "tests.h"
+#include "uwsav/uwsav_data.h"
+#include "uwsav/uwsav_writer.h"
+#include "utils/memorystream.h"
+#include "utils/sharedfilestream.h"
+
+// Size of the level block; the archive format fixes it
+static const size_t LevelBlockSize = 31752u;
+// Number of blocks in the archives of each game
+static const size_t UW1BlockCount = 135u;
+static const size_t UW2BlockCount = 320u;
+
+// Small deterministic generator of the test data
+struct TestRandom
+{
+    uint32_t State = 0x2545F491u;
+
+    uint8_t Next()
+    {
+        State ^= State << 13;
+        State ^= State >> 17;
+        State ^= State << 5;
+        return static_cast<uint8_t>(State >> 24);
+    }
+};
+
+static std::string Describe(const std::string &name, const char *how)
+{
+    return name + ", " + how;
+}
+
+// Makes a level block of random records, with valid free list sizes; most
+// bytes are zero, so that the block compresses well, like the real ones
+static void MakeLevelBlock(TestRandom &rnd, std::vector<uint8_t> &data)
+{
+    data.resize(LevelBlockSize);
+    for (auto &b : data)
+        b = (rnd.Next() % 4 == 0) ? rnd.Next() : 0u;
+    // Free list sizes, less one, are the last words but one
+    const uint16_t counts[2] = { 100u, 300u };
+    for (size_t i = 0; i < 2; ++i)
+    {
+        data[LevelBlockSize - 6 + i * 2] = static_cast<uint8_t>(counts[i]);
+        data[LevelBlockSize - 6 + i * 2 + 1] = static_cast<uint8_t>(counts[i] >> 8);
+    }
+}
+
+// Builds an archive of the game with a few levels and other blocks of
+// random data; UW2 levels are compressed if requested, and some blocks
+// have available space after them
+static void BuildArchive(GameType game, bool compress, std::vector<uint8_t> &arc)
+{
+    TestRandom rnd;
+    const bool is_uw2 = game == kGameUW2;
+    const size_t num_blocks = is_uw2 ? UW2BlockCount : UW1BlockCount;
+    // UW1: levels, animation overlay, automaps; UW2: levels of two worlds,
+    // texture map, automaps
+    const size_t level_blocks_uw1[] = { 0, 1, 2 };
+    const size_t level_blocks_uw2[] = { 0, 1, 9 };
+    const size_t other_blocks_uw1[] = { 9, 27, 28 };
+    const size_t other_blocks_uw2[] = { 80, 160, 161 };
+    const size_t *level_blocks = is_uw2 ? level_blocks_uw2 : level_blocks_uw1;
+    const size_t *other_blocks = is_uw2 ? other_blocks_uw2 : other_blocks_uw1;
+
+    std::vector<std::vector<uint8_t>> data(num_blocks);
+    std::vector<DataBlockInfo> blocks(num_blocks);
+    for (size_t i = 0; i < 3; ++i)
+    {
+        DataBlockInfo &block = blocks[level_blocks[i]];
+        std::vector<uint8_t> level;
+        MakeLevelBlock(rnd, level);
+        if (is_uw2 && compress)
+        {
+            CompressUW2Block(level.data(), level.size(), data[level_blocks[i]]);
+            block.IsCompressed = true;
+            block.Flags |= 0x2;
+        }
+        else
+        {
+            data[level_blocks[i]].swap(level);
+        }
+        std::vector<uint8_t> &other = data[other_blocks[i]];
+        other.resize(100u + rnd.Next() * 8u);
+        for (auto &b : other)
+            b = rnd.Next();
+    }
+    // Available space is stored in UW2 only
+    if (is_uw2)
+    {
+        blocks[level_blocks[1]].AvailSpace = 500u;
+        blocks[other_blocks[0]].AvailSpace = 64u;
+    }
+
+    soff_t pos = GetArchiveHeaderSize(game, static_cast<uint16_t>(num_blocks));
+    for (size_t i = 0; i < num_blocks; ++i)
+    {
+        DataBlockInfo &block = blocks[i];
+        block.Index = static_cast<uint32_t>(i);
+        if (data[i].empty())
+            continue;
+        block.Offset = static_cast<uint32_t>(pos);
+        block.Size = static_cast<uint32_t>(data[i].size());
+        block.HasAvailSpace = block.AvailSpace > 0;
+        if (block.HasAvailSpace)
+            block.Flags |= 0x4;
+        pos += block.Size + block.AvailSpace;
+    }
+
+    arc.clear();
+    Stream out(std::unique_ptr<StreamBase>(new VectorStream(arc, kStream_Write)));
+    out.WriteInt16LE(static_cast<int16_t>(num_blocks));
+    if (is_uw2)
+        out.WriteInt32LE(0);
+    WriteBlockDirectory(out, game, blocks);
+    for (size_t i = 0; i < num_blocks; ++i)
+    {
+        out.Write(data[i].data(), data[i].size());
+        const std::vector<uint8_t> avail(blocks[i].AvailSpace);
+        out.Write(avail.data(), avail.size());
+    }
+}
+
+static bool TilesEqual(const TileData &a, const TileData &b)
+{
+    return a.Type == b.Type && a.FloorHeight == b.FloorHeight && a.FloorTexture == b.FloorTexture &&
+        a.WallTexture == b.WallTexture && a.NoMagic == b.NoMagic && a.IsDoor == b.IsDoor &&
+        a.FirstObjLink == b.FirstObjLink;
+}
+
+static bool ObjectsEqual(const ObjectData &a, const ObjectData &b)
+{
+    return a.ItemID == b.ItemID && a.Flags == b.Flags && a.IsEnchanted == b.IsEnchanted &&
+        a.DoorDir == b.DoorDir && a.IsInvisible == b.IsInvisible && a.IsQuantity == b.IsQuantity &&
+        a.XPos == b.XPos && a.YPos == b.YPos && a.ZPos == b.ZPos && a.Heading == b.Heading &&
+        a.Quality == b.Quality && a.Owner == b.Owner && a.NextObjLink == b.NextObjLink &&
+        a.Quantity == b.Quantity && a.SpecialLink == b.SpecialLink && a.SpecialProperty == b.SpecialProperty;
+}
+
+static bool LevelsEqual(const LevelData &a, const LevelData &b)
+{
+    if (a.LevelID != b.LevelID || a.WorldID != b.WorldID || a.tiles.size() != b.tiles.size() ||
+        a.objs.size() != b.objs.size() || a.HasFreeLists != b.HasFreeLists ||
+        !std::equal(a.mobile_extra.begin(), a.mobile_extra.end(), b.mobile_extra.begin(), b.mobile_extra.end()) ||
+        !std::equal(a.free_mobiles.begin(), a.free_mobiles.end(), b.free_mobiles.begin(), b.free_mobiles.end()) ||
+        !std::equal(a.free_statics.begin(), a.free_statics.end(), b.free_statics.begin(), b.free_statics.end()))
+        return false;
+    for (size_t i = 0; i < a.tiles.size(); ++i)
+    {
+        if (!TilesEqual(a.tiles[i], b.tiles[i]))
+            return false;
+    }
+    for (size_t i = 0; i < a.objs.size(); ++i)
+    {
+        if (!ObjectsEqual(a.objs[i], b.objs[i]))
+            return false;
+    }
+    return true;
+}
+
+// Changes some of the tiles, objects, NPC data and free lists of the level,
+// keeping each field within its stored range
+static void ModifyLevel(LevelData &level, TestRandom &rnd)
+{
+    for (size_t i = 0; i < level.tiles.size(); i += 1 + rnd.Next() % 64)
+    {
+        TileData &tile = level.tiles[i];
+        tile.Type = static_cast<TileType>(rnd.Next() % (kTileSlopeW + 1));
+        tile.FloorHeight = rnd.Next() % 16;
+        tile.IsDoor = !tile.IsDoor;
+    }
+    for (size_t i = 1; i < level.objs.size(); i += 1 + rnd.Next() % 32)
+    {
+        ObjectData &obj = level.objs[i];
+        obj.ItemID = (obj.ItemID + 1) % 0x200;
+        obj.Quality = rnd.Next() % 64;
+        obj.XPos = rnd.Next() % 8;
+        obj.ZPos = rnd.Next() % 128;
+    }
+    for (size_t i = 0; i < level.mobile_extra.size(); i += 1 + rnd.Next() % 64)
+        level.mobile_extra[i] = rnd.Next();
+    if (!level.free_statics.empty())
+        level.free_statics.pop_back();
+}
+
+// Reads the data of the archive's block
+static void ReadBlock(const std::vector<uint8_t> &arc, const DataBlockInfo &block, std::vector<uint8_t> &data)
+{
+    const size_t offset = std::min<size_t>(block.Offset, arc.size());
+    const size_t size = std::min<size_t>(block.Size, arc.size() - offset);
+    data.assign(arc.begin() + offset, arc.begin() + offset + size);
+}
+
+// Writes the archive with the given levels modified, and checks that the
+// levels read back are the same, and the other blocks did not change
+static void CheckModified(const std::string &name, const std::vector<uint8_t> &arc, GameType game,
+                          bool modify_all, int compress_level)
+{
+    Stream src(std::unique_ptr<StreamBase>(new VectorStream(arc)));
+    std::vector<LevelData> levels;
+    ReadLevels(src, game, levels);
+    std::vector<bool> modified(levels.size());
+    TestRandom rnd;
+    for (size_t i = 0; i < levels.size(); ++i)
+    {
+        modified[i] = modify_all || i % 2 == 1;
+        if (modified[i] && !modify_all)
+            ModifyLevel(levels[i], rnd);
+    }
+
+    std::vector<uint8_t> out_arc;
+    {
+        Stream out(std::unique_ptr<StreamBase>(new VectorStream(out_arc, kStream_Write)));
+        TEST_CHECK(WriteArchive(src, game, levels, modified, out, compress_level), Describe(name, "write"));
+    }
+    Stream out_src(std::unique_ptr<StreamBase>(new VectorStream(out_arc)));
+    GameType out_game;
+    TEST_CHECK(DetectGameType(out_src, out_game) && out_game == game, Describe(name, "detect written"));
+    std::vector<LevelData> out_levels;
+    ReadLevels(out_src, game, out_levels);
+    TEST_CHECK(out_levels.size() == levels.size(), Describe(name, "level count"));
+    for (size_t i = 0; i < levels.size() && i < out_levels.size(); ++i)
+        TEST_CHECK(LevelsEqual(levels[i], out_levels[i]), Describe(name, "level read back"));
+
+    std::vector<ArchiveBlockInfo> blocks, out_blocks;
+    ReadArchiveDirectory(src, game, blocks);
+    ReadArchiveDirectory(out_src, game, out_blocks);
+    TEST_CHECK(blocks.size() == out_blocks.size(), Describe(name, "block count"));
+    for (size_t i = 0; i < blocks.size() && i < out_blocks.size(); ++i)
+    {
+        if (blocks[i].Kind == kBlockLevel)
+            continue;
+        std::vector<uint8_t> data, out_data;
+        ReadBlock(arc, blocks[i].Block, data);
+        ReadBlock(out_arc, out_blocks[i].Block, out_data);
+        TEST_CHECK(data == out_data, Describe(name, "other block"));
+    }
+}
+
+// Writes the archive without changes, checks that it's the same; and
+// repacks all levels, which gives the same archive if none is compressed
+static void CheckUnmodified(const std::string &name, const std::vector<uint8_t> &arc, GameType game)
+{
+    Stream src(std::unique_ptr<StreamBase>(new VectorStream(arc)));
+    std::vector<LevelData> levels;
+    ReadLevels(src, game, levels);
+    TEST_CHECK(!levels.empty(), Describe(name, "no levels"));
+    std::vector<LevelBlockInfo> level_blocks;
+    ReadLevelDirectory(src, game, level_blocks);
+    bool has_compressed = false;
+    for (const auto &level_block : level_blocks)
+        has_compressed |= level_block.Block.IsCompressed;
+
+    for (int pass = 0; pass < (has_compressed ? 1 : 2); ++pass)
+    {
+        const std::vector<bool> modified(levels.size(), pass > 0);
+        std::vector<uint8_t> out_arc;
+        {
+            Stream out(std::unique_ptr<StreamBase>(new VectorStream(out_arc, kStream_Write)));
+            TEST_CHECK(WriteArchive(src, game, levels, modified, out), Describe(name, "write"));
+        }
+        TEST_CHECK(out_arc == arc, Describe(name, pass > 0 ? "repacked is the same" : "unmodified is the same"));
+    }
+}
+
+static void CheckArchive(const std::string &name, const std::vector<uint8_t> &arc, GameType game)
+{
+    CheckUnmodified(name, arc, game);
+    // Modified levels are compressed as usual, or stored, which makes the
+    // compressed blocks grow and the following blocks move
+    CheckModified(name + ", modified", arc, game, false, UW2BlockEncoder::DefaultLevel);
+    CheckModified(name + ", modified, stored", arc, game, false, UW2BlockEncoder::MinLevel);
+    CheckModified(name + ", repacked, stored", arc, game, true, UW2BlockEncoder::MinLevel);
+}
+
+void TestWriter(const std::vector<std::string> &archives)
+{
+    std::vector<uint8_t> arc;
+    BuildArchive(kGameUW1, false, arc);
+    CheckArchive("synthetic UW1", arc, kGameUW1);
+    BuildArchive(kGameUW2, false, arc);
+    CheckArchive("synthetic UW2", arc, kGameUW2);
+    BuildArchive(kGameUW2, true, arc);
+    CheckArchive("synthetic UW2, compressed", arc, kGameUW2);
+
+    for (const auto &path : archives)
+    {
+        Stream in(SharedFileStream::TryOpen(path));
+        GameType game;
+        if (!in || !DetectGameType(in, game))
+        {
+            TEST_CHECK(false, "failed to open " + path);
+            continue;
+        }
+        arc.resize(static_cast<size_t>(in.GetLength()));
+        in.Seek(0, kSeekBegin);
+        arc.resize(in.Read(arc.data(), arc.size()));
+        CheckArchive(path, arc, game);
+    }
+}
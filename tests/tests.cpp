@@ -0,0 +1,29 @@
+#include "tests.h"
+#include <stdio.h>
+
+static int FailedCount = 0;
+
+void TestFailed(const char *file, int line, const char *cond, const std::string &what)
+{
+    printf("%s:%d: check failed: %s (%s)\n", file, line, cond, what.c_str());
+    FailedCount++;
+}
+
+int main(int argc, char **argv)
+{
+    // All the arguments are archives to test with
+    std::vector<std::string> archives;
+    for (int argi = 1; argi < argc; ++argi)
+        archives.push_back(argv[argi]);
+
+    TestCompress(archives);
+    TestWriter(archives);
+
+    if (FailedCount > 0)
+    {
+        printf("%d checks failed\n", FailedCount);
+        return 1;
+    }
+    printf("All checks passed\n");
+    return 0;
+}
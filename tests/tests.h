@@ -0,0 +1,27 @@
+//=============================================================================
+//
+// Round-trip checks of the archive encoders and writers.
+//
+// The checks are plain functions, grouped by the module they test; each
+// group runs over the synthetic data first, and then over the archives
+// given in the command line, if any. A failed check is reported and
+// counted, and the group goes on, so that one run reports all failures.
+//
+//=============================================================================
+#ifndef UWSAV_TESTS__TESTS_H__
+#define UWSAV_TESTS__TESTS_H__
+
+#include <string>
+#include <vector>
+
+// Checks the condition, reports and counts the failure
+#define TEST_CHECK(cond, what) \
+    do { if (!(cond)) TestFailed(__FILE__, __LINE__, #cond, what); } while (0)
+
+void TestFailed(const char *file, int line, const char *cond, const std::string &what);
+
+// Test groups; archives are the paths of LEVEL.ARK files to test with
+void TestCompress(const std::vector<std::string> &archives);
+void TestWriter(const std::vector<std::string> &archives);
+
+#endif // UWSAV_TESTS__TESTS_H__
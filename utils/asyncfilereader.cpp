@@ -0,0 +1,361 @@
+#include "asyncfilereader.h"
+#include <algorithm>
+#include <vector>
+#include <string.h>
+#include "spscqueue.h"
+
+#if defined(__linux__) && !defined(NO_IO_URING) && defined(__has_include)
+#if __has_include(<linux/io_uring.h>)
+#define HAVE_IO_URING (1)
+#endif
+#endif
+
+#if defined(HAVE_IO_URING)
+#include <errno.h>
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#include <unistd.h>
+#endif
+
+struct AsyncFileReader::Request
+{
+    int      Fd = -1;
+    soff_t   Offset = 0;
+    uint8_t *Buffer = nullptr;
+    size_t   Size = 0u;
+    size_t   Done = 0u; // bytes already read
+    Callback OnDone;
+#if defined(HAVE_IO_URING)
+    struct iovec Iov = {};
+#endif
+};
+
+#if defined(HAVE_IO_URING)
+
+// io_uring instance, with the shared submission and completion rings
+/*
+    The application fills in submission queue entries (SQE), and advances
+    the SQ tail; the kernel consumes entries from the SQ head. The kernel
+    posts completion queue entries (CQE) and advances the CQ tail; the
+    application consumes them from the CQ head. Each side only writes its
+    own index, and reads the other one, so no locking is needed.
+*/
+struct AsyncFileReader::Ring
+{
+    int         Fd = -1;
+    unsigned    Entries = 0u;
+    void       *SqPtr = nullptr;
+    size_t      SqSize = 0u;
+    void       *CqPtr = nullptr;
+    size_t      CqSize = 0u;
+    io_uring_sqe *Sqes = nullptr;
+    size_t      SqesSize = 0u;
+
+    unsigned   *SqHead = nullptr;
+    unsigned   *SqTail = nullptr;
+    unsigned   *SqMask = nullptr;
+    unsigned   *SqArray = nullptr;
+    unsigned   *CqHead = nullptr;
+    unsigned   *CqTail = nullptr;
+    unsigned   *CqMask = nullptr;
+    io_uring_cqe *Cqes = nullptr;
+
+    ~Ring()
+    {
+        if (Sqes)
+            munmap(Sqes, SqesSize);
+        if (CqPtr && CqPtr != SqPtr)
+            munmap(CqPtr, CqSize);
+        if (SqPtr)
+            munmap(SqPtr, SqSize);
+        if (Fd >= 0)
+            close(Fd);
+    }
+
+    bool Init(unsigned entries)
+    {
+        io_uring_params p;
+        memset(&p, 0, sizeof(p));
+        Fd = static_cast<int>(syscall(__NR_io_uring_setup, entries, &p));
+        if (Fd < 0)
+            return false;
+        Entries = p.sq_entries;
+
+        SqSize = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+        CqSize = p.cq_off.cqes + p.cq_entries * sizeof(io_uring_cqe);
+        const bool single_mmap = (p.features & IORING_FEAT_SINGLE_MMAP) != 0;
+        if (single_mmap)
+            SqSize = CqSize = std::max(SqSize, CqSize);
+
+        SqPtr = mmap(nullptr, SqSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                     Fd, IORING_OFF_SQ_RING);
+        if (SqPtr == MAP_FAILED)
+        {
+            SqPtr = nullptr;
+            return false;
+        }
+        if (single_mmap)
+        {
+            CqPtr = SqPtr;
+        }
+        else
+        {
+            CqPtr = mmap(nullptr, CqSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                         Fd, IORING_OFF_CQ_RING);
+            if (CqPtr == MAP_FAILED)
+            {
+                CqPtr = nullptr;
+                return false;
+            }
+        }
+        SqesSize = p.sq_entries * sizeof(io_uring_sqe);
+        void *sqes = mmap(nullptr, SqesSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                          Fd, IORING_OFF_SQES);
+        if (sqes == MAP_FAILED)
+            return false;
+        Sqes = static_cast<io_uring_sqe*>(sqes);
+
+        uint8_t *sq = static_cast<uint8_t*>(SqPtr);
+        SqHead = reinterpret_cast<unsigned*>(sq + p.sq_off.head);
+        SqTail = reinterpret_cast<unsigned*>(sq + p.sq_off.tail);
+        SqMask = reinterpret_cast<unsigned*>(sq + p.sq_off.ring_mask);
+        SqArray = reinterpret_cast<unsigned*>(sq + p.sq_off.array);
+        uint8_t *cq = static_cast<uint8_t*>(CqPtr);
+        CqHead = reinterpret_cast<unsigned*>(cq + p.cq_off.head);
+        CqTail = reinterpret_cast<unsigned*>(cq + p.cq_off.tail);
+        CqMask = reinterpret_cast<unsigned*>(cq + p.cq_off.ring_mask);
+        Cqes = reinterpret_cast<io_uring_cqe*>(cq + p.cq_off.cqes);
+        return true;
+    }
+
+    // Puts a read request into the submission ring, marked with its slot
+    void Push(Request *req, size_t slot)
+    {
+        const unsigned tail = *SqTail; // only written by us
+        const unsigned index = tail & *SqMask;
+        io_uring_sqe *sqe = &Sqes[index];
+        memset(sqe, 0, sizeof(*sqe));
+        req->Iov.iov_base = req->Buffer + req->Done;
+        req->Iov.iov_len = req->Size - req->Done;
+        sqe->opcode = IORING_OP_READV;
+        sqe->fd = req->Fd;
+        sqe->off = static_cast<uint64_t>(req->Offset + req->Done);
+        sqe->addr = reinterpret_cast<uint64_t>(&req->Iov);
+        sqe->len = 1;
+        sqe->user_data = static_cast<uint64_t>(slot);
+        SqArray[index] = index;
+        __atomic_store_n(SqTail, tail + 1, __ATOMIC_RELEASE);
+    }
+
+    // Submits all the pushed requests, and waits for at least one completion
+    bool SubmitAndWait()
+    {
+        for (;;)
+        {
+            const unsigned to_submit = *SqTail - __atomic_load_n(SqHead, __ATOMIC_ACQUIRE);
+            int ret = static_cast<int>(syscall(__NR_io_uring_enter, Fd, to_submit, 1,
+                                               IORING_ENTER_GETEVENTS, nullptr, 0));
+            if (ret >= 0)
+                return true;
+            if (errno != EINTR && errno != EAGAIN)
+                return false;
+        }
+    }
+
+    // Waits for at least one completion, without submitting anything
+    bool Wait()
+    {
+        return syscall(__NR_io_uring_enter, Fd, 0, 1, IORING_ENTER_GETEVENTS, nullptr, 0) >= 0;
+    }
+
+    // Takes back the pushed requests which the kernel has not consumed,
+    // and returns their slots. The kernel only consumes the submissions
+    // while it is entered, so these are never seen by it.
+    void TakeBack(std::vector<size_t> &slots)
+    {
+        const unsigned head = __atomic_load_n(SqHead, __ATOMIC_ACQUIRE);
+        const unsigned tail = *SqTail;
+        for (unsigned i = head; i != tail; ++i)
+            slots.push_back(static_cast<size_t>(Sqes[SqArray[i & *SqMask]].user_data));
+        __atomic_store_n(SqTail, head, __ATOMIC_RELEASE);
+    }
+};
+
+std::unique_ptr<AsyncFileReader> AsyncFileReader::Create(unsigned queue_depth)
+{
+    std::unique_ptr<Ring> ring(new Ring());
+    if (!ring->Init(queue_depth))
+        return nullptr;
+    const unsigned entries = ring->Entries;
+    std::unique_ptr<AsyncFileReader> reader(new AsyncFileReader(std::move(ring)));
+    reader->_submitted.resize(entries);
+    for (size_t slot = entries; slot > 0; --slot)
+        reader->_freeSlots.push_back(slot - 1);
+    return reader;
+}
+
+void AsyncFileReader::Queue(const SharedFile &file, soff_t offset, void *buffer, size_t size,
+                            Callback on_done)
+{
+    std::unique_ptr<Request> req(new Request());
+    req->Fd = file.GetDescriptor();
+    req->Offset = offset;
+    req->Buffer = static_cast<uint8_t*>(buffer);
+    req->Size = size;
+    req->OnDone = std::move(on_done);
+    _queued.push_back(std::move(req));
+}
+
+void AsyncFileReader::FillSubmissions()
+{
+    while (!_queued.empty() && !_freeSlots.empty())
+    {
+        const size_t slot = _freeSlots.back();
+        _freeSlots.pop_back();
+        _ring->Push(_queued.front().get(), slot);
+        _submitted[slot] = std::move(_queued.front());
+        _queued.pop_front();
+        _inFlight++;
+    }
+}
+
+void AsyncFileReader::ReadSync(Request &req)
+{
+    while (req.Done < req.Size)
+    {
+        ssize_t was_read = pread(req.Fd, req.Buffer + req.Done, req.Size - req.Done,
+                                 static_cast<off_t>(req.Offset + req.Done));
+        if (was_read < 0 && errno == EINTR)
+            continue;
+        if (was_read <= 0)
+            break;
+        req.Done += static_cast<size_t>(was_read);
+    }
+}
+
+bool AsyncFileReader::Poll()
+{
+    if (!HasPending())
+        return false;
+
+    std::vector<std::unique_ptr<Request>> completed;
+    if (!_failed)
+    {
+        FillSubmissions();
+        if (!_ring->SubmitAndWait())
+        {
+            // The ring is unusable; take back the requests which the kernel
+            // has not consumed, these are read synchronously below
+            _failed = true;
+            std::vector<size_t> slots;
+            _ring->TakeBack(slots);
+            for (size_t slot : slots)
+            {
+                _queued.push_back(std::move(_submitted[slot]));
+                _freeSlots.push_back(slot);
+                _inFlight--;
+            }
+        }
+    }
+
+    if (_failed)
+    {
+        // The kernel may still write into the buffers of the requests it
+        // has consumed, so all of these must complete before any callback
+        // is run, as the callbacks may release other buffers
+        SpinBackoff backoff;
+        while (_inFlight > 0)
+        {
+            if (!ReapCompletions(completed) && !_ring->Wait())
+                backoff.Pause();
+        }
+        // Everything else, including the retries, is read synchronously
+        for (auto &req : _queued)
+        {
+            ReadSync(*req);
+            completed.push_back(std::move(req));
+        }
+        _queued.clear();
+    }
+    else
+    {
+        ReapCompletions(completed);
+    }
+
+    // Run callbacks only after the ring is updated, as these may queue more reads
+    for (auto &req : completed)
+        req->OnDone(req->Done);
+    return true;
+}
+
+bool AsyncFileReader::ReapCompletions(std::vector<std::unique_ptr<Request>> &completed)
+{
+    unsigned head = *_ring->CqHead; // only written by us
+    const unsigned tail = __atomic_load_n(_ring->CqTail, __ATOMIC_ACQUIRE);
+    for (; head != tail; ++head)
+    {
+        const io_uring_cqe &cqe = _ring->Cqes[head & *_ring->CqMask];
+        const size_t slot = static_cast<size_t>(cqe.user_data);
+        std::unique_ptr<Request> req(std::move(_submitted[slot]));
+        _freeSlots.push_back(slot);
+        _inFlight--;
+        if (cqe.res == -EINTR || cqe.res == -EAGAIN)
+        {
+            _queued.push_front(std::move(req)); // retry
+            continue;
+        }
+        if (cqe.res > 0)
+        {
+            req->Done += static_cast<size_t>(cqe.res);
+            if (req->Done < req->Size)
+            {
+                _queued.push_front(std::move(req)); // short read, continue
+                continue;
+            }
+        }
+        completed.push_back(std::move(req));
+    }
+    const bool reaped = head != *_ring->CqHead;
+    __atomic_store_n(_ring->CqHead, head, __ATOMIC_RELEASE);
+    return reaped;
+}
+
+#else // !HAVE_IO_URING
+
+struct AsyncFileReader::Ring
+{
+};
+
+std::unique_ptr<AsyncFileReader> AsyncFileReader::Create(unsigned /*queue_depth*/)
+{
+    return nullptr;
+}
+
+void AsyncFileReader::Queue(const SharedFile &/*file*/, soff_t /*offset*/, void * /*buffer*/,
+                            size_t /*size*/, Callback /*on_done*/)
+{
+}
+
+void AsyncFileReader::FillSubmissions()
+{
+}
+
+bool AsyncFileReader::Poll()
+{
+    return false;
+}
+
+#endif // HAVE_IO_URING
+
+AsyncFileReader::AsyncFileReader(std::unique_ptr<Ring> ring)
+    : _ring(std::move(ring))
+{
+}
+
+AsyncFileReader::~AsyncFileReader()
+{
+    // Wait for the reads in progress, as the kernel may still write to their buffers
+    while (_inFlight > 0 && Poll()) {}
+}
@@ -0,0 +1,76 @@
+//=============================================================================
+//
+// Asynchronous file reader, which lets queue many positional reads at once,
+// and have them processed by the system in parallel, keeping the disk queue
+// deep. Completion callbacks are run on the thread that polls the reader,
+// and may queue more reads.
+//
+// Currently implemented on Linux over io_uring; on other systems, or if
+// io_uring is not permitted by the system, AsyncFileReader::Create returns
+// null, and the caller is expected to use the regular file streams.
+// Define NO_IO_URING to disable io_uring backend at compile time.
+//
+//=============================================================================
+#ifndef COMMON_UTILS__ASYNCFILEREADER_H__
+#define COMMON_UTILS__ASYNCFILEREADER_H__
+
+#include <deque>
+#include <functional>
+#include <memory>
+#include <vector>
+#include "sharedfilestream.h"
+
+class AsyncFileReader
+{
+public:
+    // Read completion callback, receives number of bytes read;
+    // this is less than requested if end of file was reached or an error
+    // occured.
+    typedef std::function<void(size_t was_read)> Callback;
+
+    // Creates asynchronous reader with the given queue depth;
+    // returns null if asynchronous reading is not supported on this system
+    static std::unique_ptr<AsyncFileReader> Create(unsigned queue_depth = 64u);
+    ~AsyncFileReader();
+
+    // Queues a read of size bytes at the file offset into the buffer;
+    // both the file and the buffer must persist until completion
+    void    Queue(const SharedFile &file, soff_t offset, void *buffer, size_t size,
+                  Callback on_done);
+    // Tells if there are any reads queued or in progress
+    bool    HasPending() const { return !_queued.empty() || _inFlight > 0; }
+    // Submits queued reads, waits for at least one of them to complete,
+    // and runs callbacks for all the completed reads. If the system fails
+    // to process the reads, then those already taken by the system are
+    // waited for, and the rest are done with the regular reads instead,
+    // and so are any reads queued after.
+    // Returns false if there was nothing to wait for.
+    bool    Poll();
+
+private:
+    struct Ring;
+    struct Request;
+
+    AsyncFileReader(std::unique_ptr<Ring> ring);
+    AsyncFileReader(const AsyncFileReader&) = delete;
+    AsyncFileReader &operator=(const AsyncFileReader&) = delete;
+
+    // Moves queued requests into the submission ring, as long as it has space
+    void    FillSubmissions();
+    // Takes the completed requests from the ring; those which need another
+    // read are queued again. Returns false if there were none.
+    bool    ReapCompletions(std::vector<std::unique_ptr<Request>> &completed);
+    // Reads the rest of the request with the regular positional reads
+    static void ReadSync(Request &req);
+
+    std::unique_ptr<Ring> _ring;
+    std::deque<std::unique_ptr<Request>> _queued;
+    // Requests in the submission ring, by their slots; the slot is passed
+    // with the request, and tells which one has completed
+    std::vector<std::unique_ptr<Request>> _submitted;
+    std::vector<size_t> _freeSlots;
+    unsigned _inFlight = 0u;
+    bool _failed = false; // the ring failed, requests are read synchronously
+};
+
+#endif // COMMON_UTILS__ASYNCFILEREADER_H__
@@ -7,12 +7,25 @@
 #define COMMON_UTILS__BBOP_H__
 
 #include "platform.h"
+#include <stddef.h>
 #include <stdint.h>
 
 #if PLATFORM_ENDIAN_BIG || defined (TEST_BIGENDIAN)
 #define BITBYTE_BIG_ENDIAN
 #endif
 
+// SIMD instruction sets used for swapping bytes in arrays
+#if defined(__SSSE3__)
+#define BITBYTE_SIMD_SSSE3
+#include <tmmintrin.h>
+#elif defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define BITBYTE_SIMD_SSE2
+#include <emmintrin.h>
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+#define BITBYTE_SIMD_NEON
+#include <arm_neon.h>
+#endif
+
 namespace BitByteOperations
 {
     inline int16_t SwapBytesInt16(const int16_t val)
@@ -45,6 +58,66 @@ namespace BitByteOperations
         return swapper.f;
     }
 
+    // Swaps bytes in each element of the array, in place
+    inline void SwapBytesArrayInt16(int16_t *arr, size_t count)
+    {
+        size_t i = 0;
+#if defined (BITBYTE_SIMD_SSSE3)
+        const __m128i shuf = _mm_setr_epi8(1, 0, 3, 2, 5, 4, 7, 6, 9, 8, 11, 10, 13, 12, 15, 14);
+        for (; i + 8 <= count; i += 8)
+        {
+            __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(arr + i));
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(arr + i), _mm_shuffle_epi8(v, shuf));
+        }
+#elif defined (BITBYTE_SIMD_SSE2)
+        for (; i + 8 <= count; i += 8)
+        {
+            __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(arr + i));
+            v = _mm_or_si128(_mm_slli_epi16(v, 8), _mm_srli_epi16(v, 8));
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(arr + i), v);
+        }
+#elif defined (BITBYTE_SIMD_NEON)
+        for (; i + 8 <= count; i += 8)
+        {
+            uint8x16_t v = vld1q_u8(reinterpret_cast<const uint8_t*>(arr + i));
+            vst1q_u8(reinterpret_cast<uint8_t*>(arr + i), vrev16q_u8(v));
+        }
+#endif
+        for (; i < count; ++i)
+            arr[i] = SwapBytesInt16(arr[i]);
+    }
+
+    // Swaps bytes in each element of the array, in place
+    inline void SwapBytesArrayInt32(int32_t *arr, size_t count)
+    {
+        size_t i = 0;
+#if defined (BITBYTE_SIMD_SSSE3)
+        const __m128i shuf = _mm_setr_epi8(3, 2, 1, 0, 7, 6, 5, 4, 11, 10, 9, 8, 15, 14, 13, 12);
+        for (; i + 4 <= count; i += 4)
+        {
+            __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(arr + i));
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(arr + i), _mm_shuffle_epi8(v, shuf));
+        }
+#elif defined (BITBYTE_SIMD_SSE2)
+        for (; i + 4 <= count; i += 4)
+        {
+            __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(arr + i));
+            // swap 16-bit halves of each 32-bit element, then bytes in each half
+            v = _mm_shufflehi_epi16(_mm_shufflelo_epi16(v, 0xB1), 0xB1);
+            v = _mm_or_si128(_mm_slli_epi16(v, 8), _mm_srli_epi16(v, 8));
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(arr + i), v);
+        }
+#elif defined (BITBYTE_SIMD_NEON)
+        for (; i + 4 <= count; i += 4)
+        {
+            uint8x16_t v = vld1q_u8(reinterpret_cast<const uint8_t*>(arr + i));
+            vst1q_u8(reinterpret_cast<uint8_t*>(arr + i), vrev32q_u8(v));
+        }
+#endif
+        for (; i < count; ++i)
+            arr[i] = SwapBytesInt32(arr[i]);
+    }
+
     inline int16_t Int16FromLE(const int16_t val)
     {
 #if defined (BITBYTE_BIG_ENDIAN)
@@ -81,6 +154,24 @@ namespace BitByteOperations
 #endif
     }
 
+    inline void Int16ArrayFromLE(int16_t *arr, size_t count)
+    {
+#if defined (BITBYTE_BIG_ENDIAN)
+        SwapBytesArrayInt16(arr, count);
+#else
+        (void)arr; (void)count;
+#endif
+    }
+
+    inline void Int32ArrayFromLE(int32_t *arr, size_t count)
+    {
+#if defined (BITBYTE_BIG_ENDIAN)
+        SwapBytesArrayInt32(arr, count);
+#else
+        (void)arr; (void)count;
+#endif
+    }
+
     inline int16_t Int16FromBE(const int16_t val)
     {
 #if defined (BITBYTE_BIG_ENDIAN)
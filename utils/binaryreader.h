@@ -0,0 +1,98 @@
+//=============================================================================
+//
+// BinaryReader is a lightweight non-virtual reader over a span of bytes in
+// memory. Unlike Stream, it has no per-read bounds checks: the caller is
+// expected to test that the whole record is available with Require() or
+// GetRemaining(), and then read its fields with inline unchecked reads.
+// Does not own the data, which *must* persist while the reader is used.
+//
+//=============================================================================
+#ifndef COMMON_UTILS__BINARYREADER_H__
+#define COMMON_UTILS__BINARYREADER_H__
+
+#include <assert.h>
+#include <stddef.h>
+#include <string.h>
+#include "bbop.h"
+
+class BinaryReader
+{
+public:
+    BinaryReader() = default;
+    BinaryReader(const uint8_t *data, size_t size)
+        : _data(data), _size(data ? size : 0u) {}
+
+    const uint8_t *GetData() const { return _data; }
+    size_t GetSize() const      { return _size; }
+    size_t GetPosition() const  { return _pos; }
+    size_t GetRemaining() const { return _size - _pos; }
+    bool   EOS() const          { return _pos >= _size; }
+
+    // Tells if the next size bytes are available for reading
+    bool Require(size_t size) const { return _size - _pos >= size; }
+
+    // Sets the read position; clamped to the data size
+    void Seek(size_t pos) { _pos = pos < _size ? pos : _size; }
+    // Skips number of bytes; clamped to the data size
+    void Skip(size_t size) { Seek(_pos + (Require(size) ? size : GetRemaining())); }
+
+    //
+    // Following are unchecked reads; availability of data must be tested
+    // beforehand with Require().
+    //
+
+    // Returns a pointer to the next size bytes, and advances past them
+    const uint8_t *ReadBytes(size_t size)
+    {
+        assert(Require(size));
+        const uint8_t *p = _data + _pos;
+        _pos += size;
+        return p;
+    }
+    // Copies next size bytes into the buffer
+    void Read(void *buffer, size_t size)
+    {
+        memcpy(buffer, ReadBytes(size), size);
+    }
+    int8_t ReadInt8()
+    {
+        assert(Require(sizeof(int8_t)));
+        return static_cast<int8_t>(_data[_pos++]);
+    }
+    int16_t ReadInt16LE()
+    {
+        int16_t val;
+        Read(&val, sizeof(int16_t));
+        return BBOp::Int16FromLE(val);
+    }
+    int32_t ReadInt32LE()
+    {
+        int32_t val;
+        Read(&val, sizeof(int32_t));
+        return BBOp::Int32FromLE(val);
+    }
+    int64_t ReadInt64LE()
+    {
+        int64_t val;
+        Read(&val, sizeof(int64_t));
+        return BBOp::Int64FromLE(val);
+    }
+    // Reads an array of count values
+    void ReadArrayInt16LE(int16_t *buffer, size_t count)
+    {
+        Read(buffer, count * sizeof(int16_t));
+        BBOp::Int16ArrayFromLE(buffer, count);
+    }
+    void ReadArrayInt32LE(int32_t *buffer, size_t count)
+    {
+        Read(buffer, count * sizeof(int32_t));
+        BBOp::Int32ArrayFromLE(buffer, count);
+    }
+
+private:
+    const uint8_t *_data = nullptr;
+    size_t _size = 0u;
+    size_t _pos = 0u;
+};
+
+#endif // COMMON_UTILS__BINARYREADER_H__
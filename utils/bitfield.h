@@ -0,0 +1,70 @@
+//=============================================================================
+//
+// Bit field descriptors.
+//
+// BitField describes a range of bits within an integer value, and provides
+// constexpr getter and setter for it. PackedField binds such bit range to
+// a particular member of a struct, which lets describe packed binary
+// records as a list of typedefs, and get or set their fields by name
+// without writing any shifts and masks by hand.
+//
+// Example:
+//     struct Packed { uint16_t data1; };
+//     typedef PackedField<Packed, uint16_t, &Packed::data1, 4, 3> FieldA;
+//     uint16_t a = FieldA::Get(packed);
+//     FieldA::Set(packed, 5);
+//
+//=============================================================================
+#ifndef COMMON_UTILS__BITFIELD_H__
+#define COMMON_UTILS__BITFIELD_H__
+
+#include <type_traits>
+
+template <typename T, unsigned Offset, unsigned Width>
+struct BitField
+{
+    static_assert(std::is_integral<T>::value && std::is_unsigned<T>::value,
+        "BitField requires unsigned integer type");
+    static_assert(Width > 0 && Offset + Width <= sizeof(T) * 8,
+        "BitField exceeds the size of the value type");
+
+    typedef T ValueType;
+
+    // Mask of the field's value, not shifted
+    static constexpr T Mask()
+    {
+        return static_cast<T>(Width >= sizeof(T) * 8 ? ~T(0) : ((T(1) << Width) - 1));
+    }
+
+    // Extracts field value from the packed integer
+    static constexpr T Get(T packed)
+    {
+        return static_cast<T>((packed >> Offset) & Mask());
+    }
+
+    // Returns packed integer with the field value replaced;
+    // value is truncated to the field's width
+    static constexpr T Set(T packed, T value)
+    {
+        return static_cast<T>((packed & ~(Mask() << Offset)) | ((value & Mask()) << Offset));
+    }
+};
+
+template <typename TStruct, typename T, T TStruct::*Member, unsigned Offset, unsigned Width>
+struct PackedField
+{
+    typedef BitField<T, Offset, Width> Field;
+    typedef T ValueType;
+
+    static constexpr T Get(const TStruct &s)
+    {
+        return Field::Get(s.*Member);
+    }
+
+    static constexpr void Set(TStruct &s, T value)
+    {
+        s.*Member = Field::Set(s.*Member, value);
+    }
+};
+
+#endif // COMMON_UTILS__BITFIELD_H__
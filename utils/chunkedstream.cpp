@@ -0,0 +1,210 @@
+#include "chunkedstream.h"
+#include <string.h>
+#include "filestream.h"
+
+// Number of chunks the writer may run behind: one is being written, while
+// the next one waits
+static const size_t WriteQueueSize = 2u;
+// Number of written chunks kept for reuse
+static const size_t FreeQueueSize = 4u;
+
+ChunkedWriteStream::ChunkedWriteStream(std::unique_ptr<StreamBase> dest,
+                                       size_t chunk_size, size_t keep_chunks)
+    : StreamBase(dest ? dest->GetPath() : std::string())
+    , _dest(std::move(dest))
+    , _chunkSize(std::max<size_t>(chunk_size, 1u))
+    , _keepChunks(keep_chunks)
+    , _writeQueue(WriteQueueSize)
+    , _freeQueue(FreeQueueSize)
+{
+    if (_dest)
+        _writer = std::thread(&ChunkedWriteStream::WriterThread, this);
+}
+
+ChunkedWriteStream::~ChunkedWriteStream()
+{
+    Close();
+}
+
+std::unique_ptr<ChunkedWriteStream> ChunkedWriteStream::TryOpen(const std::string &path)
+{
+    std::unique_ptr<FileStream> file = FileStream::TryOpen(path, kFileMode_CreateAlways, kStream_Write);
+    if (!file)
+        return nullptr;
+    return std::unique_ptr<ChunkedWriteStream>(new ChunkedWriteStream(std::move(file)));
+}
+
+bool ChunkedWriteStream::IsValid() const
+{
+    return _dest && _dest->IsValid() && !_failed.load(std::memory_order_acquire);
+}
+
+bool ChunkedWriteStream::EOS() const
+{
+    return _pos >= _length;
+}
+
+soff_t ChunkedWriteStream::GetLength() const
+{
+    return _length;
+}
+
+soff_t ChunkedWriteStream::GetPosition() const
+{
+    return _pos;
+}
+
+bool ChunkedWriteStream::CanRead() const
+{
+    return false;
+}
+
+bool ChunkedWriteStream::CanWrite() const
+{
+    return _writer.joinable();
+}
+
+bool ChunkedWriteStream::CanSeek() const
+{
+    return _writer.joinable();
+}
+
+size_t ChunkedWriteStream::Read(void * /*buffer*/, size_t /*size*/)
+{
+    return 0;
+}
+
+int32_t ChunkedWriteStream::ReadByte()
+{
+    return -1;
+}
+
+size_t ChunkedWriteStream::Write(const void *buffer, size_t size)
+{
+    if (!_writer.joinable())
+        return 0;
+    const uint8_t *src = static_cast<const uint8_t*>(buffer);
+    const size_t total = size;
+    while (size > 0)
+    {
+        const size_t index = static_cast<size_t>((_pos - _base) / _chunkSize);
+        const size_t offset = static_cast<size_t>((_pos - _base) % _chunkSize);
+        if (index == _chunks.size())
+            _chunks.push_back(GetFreeChunk());
+        Chunk &chunk = *_chunks[index];
+        const size_t count = std::min(size, _chunkSize - offset);
+        memcpy(chunk.Data.get() + offset, src, count);
+        chunk.Size = std::max(chunk.Size, offset + count);
+        src += count;
+        size -= count;
+        _pos += count;
+        _length = std::max(_length, _pos);
+
+        // Hand over the chunks which fell out of the kept ones, but never
+        // the one at the current position; this is done as each chunk is
+        // filled, so that a large write is not held in memory whole
+        while (_chunks.size() > _keepChunks + 1 &&
+               _pos - _base >= static_cast<soff_t>(_chunkSize))
+            SendFirstChunk();
+    }
+    return total;
+}
+
+int32_t ChunkedWriteStream::WriteByte(uint8_t b)
+{
+    if (Write(&b, 1) != 1)
+        return -1;
+    return b;
+}
+
+bool ChunkedWriteStream::Seek(soff_t offset, StreamSeek origin)
+{
+    if (!_writer.joinable())
+        return false;
+    soff_t pos;
+    switch (origin)
+    {
+    case kSeekBegin:    pos = offset; break;
+    case kSeekCurrent:  pos = _pos + offset; break;
+    case kSeekEnd:      pos = _length + offset; break;
+    default:
+        return false;
+    }
+    // The data before the first chunk in memory is already written out
+    if (pos < _base || pos > _length)
+        return false;
+    _pos = pos;
+    return true;
+}
+
+void ChunkedWriteStream::Close()
+{
+    if (!_writer.joinable())
+        return;
+    while (!_chunks.empty())
+        SendFirstChunk();
+    _writeQueue.Close();
+    _writer.join();
+    _dest->Close();
+}
+
+bool ChunkedWriteStream::Flush()
+{
+    if (!_writer.joinable())
+        return false;
+    if (_pos == _length)
+    {
+        while (!_chunks.empty())
+            SendFirstChunk();
+    }
+    else
+    {
+        while (_pos - _base >= static_cast<soff_t>(_chunkSize))
+            SendFirstChunk();
+    }
+    WaitWriter();
+    // The writer is idle now, and does not touch the destination
+    return _dest->Flush() && !_failed.load(std::memory_order_acquire);
+}
+
+std::unique_ptr<ChunkedWriteStream::Chunk> ChunkedWriteStream::GetFreeChunk()
+{
+    std::unique_ptr<Chunk> chunk;
+    if (!_freeQueue.TryPop(chunk))
+    {
+        chunk.reset(new Chunk());
+        chunk->Data.reset(new uint8_t[_chunkSize]);
+    }
+    return chunk;
+}
+
+void ChunkedWriteStream::SendFirstChunk()
+{
+    _base += _chunks.front()->Size;
+    _writeQueue.Push(std::move(_chunks.front()));
+    _chunks.pop_front();
+    _sentCount++;
+}
+
+void ChunkedWriteStream::WaitWriter()
+{
+    SpinBackoff backoff;
+    while (_writtenCount.load(std::memory_order_acquire) != _sentCount)
+        backoff.Pause();
+}
+
+void ChunkedWriteStream::WriterThread()
+{
+    std::unique_ptr<Chunk> chunk;
+    while (_writeQueue.Pop(chunk))
+    {
+        if (!_failed.load(std::memory_order_relaxed) &&
+            _dest->Write(chunk->Data.get(), chunk->Size) != chunk->Size)
+            _failed.store(true, std::memory_order_release);
+        chunk->Size = 0u;
+        // If there are enough free chunks already, this one is released
+        _freeQueue.TryPush(chunk);
+        chunk.reset();
+        _writtenCount.fetch_add(1u, std::memory_order_release);
+    }
+}
@@ -0,0 +1,103 @@
+//=============================================================================
+//
+// Chunked output stream with a background writer.
+//
+// ChunkedWriteStream collects the written data in a list of fixed-size
+// memory chunks, so growing the output never reallocates nor copies what
+// was already written. The most recent chunks are kept in memory, where
+// the stream may seek back and overwrite them, e.g. to patch in a summary
+// which is known only after the data that follows it. Older chunks are
+// handed over to a writer thread, which writes them to the destination
+// stream while the next chunks are filled, and returns them for reuse.
+// The writer may run behind only a few chunks; when it does, writing waits
+// for it, which keeps the memory use bounded.
+//
+// The stream is write-only. Seeking is allowed within the chunks still in
+// memory; Flush hands over all the chunks before the current position.
+// Errors of the destination are reported by Flush and IsValid only, since
+// the data is written there later.
+//
+//=============================================================================
+#ifndef COMMON_UTILS__CHUNKEDSTREAM_H__
+#define COMMON_UTILS__CHUNKEDSTREAM_H__
+
+#include <atomic>
+#include <deque>
+#include <thread>
+#include "stream.h"
+#include "spscqueue.h"
+
+class ChunkedWriteStream : public StreamBase
+{
+public:
+    static const size_t DefaultChunkSize = 64u * 1024u;
+    // Default number of the full chunks kept in memory, for seeking back
+    static const size_t DefaultKeepChunks = 16u;
+
+    // Creates a stream over the destination stream, which is then only
+    // accessed by the writer thread until this stream is closed
+    ChunkedWriteStream(std::unique_ptr<StreamBase> dest,
+                       size_t chunk_size = DefaultChunkSize, size_t keep_chunks = DefaultKeepChunks);
+    ~ChunkedWriteStream() override;
+
+    // Creates or truncates a file, and opens a stream over it
+    static std::unique_ptr<ChunkedWriteStream> TryOpen(const std::string &path);
+
+    bool    IsValid() const override;
+    bool    EOS() const override;
+    soff_t  GetLength() const override;
+    soff_t  GetPosition() const override;
+    bool    CanRead() const override;
+    bool    CanWrite() const override;
+    bool    CanSeek() const override;
+
+    size_t  Read(void *buffer, size_t size) override;
+    int32_t ReadByte() override;
+    size_t  Write(const void *buffer, size_t size) override;
+    int32_t WriteByte(uint8_t b) override;
+
+    // Seeks within the part of the stream which is still in memory
+    bool    Seek(soff_t offset, StreamSeek origin) override;
+
+    // Writes out all the data and closes the destination
+    void    Close() override;
+    // Writes out the data before the current position, and waits until
+    // the destination is flushed
+    bool    Flush() override;
+
+private:
+    struct Chunk
+    {
+        std::unique_ptr<uint8_t[]> Data;
+        size_t Size = 0u; // bytes used
+    };
+
+    ChunkedWriteStream(const ChunkedWriteStream&) = delete;
+    ChunkedWriteStream &operator=(const ChunkedWriteStream&) = delete;
+
+    // Gets a chunk returned by the writer, or allocates a new one
+    std::unique_ptr<Chunk> GetFreeChunk();
+    // Hands over the first chunk to the writer
+    void    SendFirstChunk();
+    // Waits until the writer has written everything sent to it
+    void    WaitWriter();
+    void    WriterThread();
+
+    std::unique_ptr<StreamBase> _dest;
+    const size_t _chunkSize;
+    const size_t _keepChunks;
+    // Chunks in memory; all of them but the last one are full
+    std::deque<std::unique_ptr<Chunk>> _chunks;
+    soff_t  _base = 0; // stream offset of the first chunk in memory
+    soff_t  _pos = 0;
+    soff_t  _length = 0;
+
+    SpscQueue<std::unique_ptr<Chunk>> _writeQueue; // to the writer
+    SpscQueue<std::unique_ptr<Chunk>> _freeQueue; // back from the writer
+    size_t  _sentCount = 0u;
+    std::atomic<size_t> _writtenCount { 0u };
+    std::atomic<bool> _failed { false };
+    std::thread _writer;
+};
+
+#endif // COMMON_UTILS__CHUNKEDSTREAM_H__
@@ -0,0 +1,129 @@
+#include "crc32c.h"
+
+#if defined(__x86_64__) || defined(__i386__) || defined(_M_X64) || defined(_M_IX86)
+    #define CRC32C_X86 (1)
+    #include <nmmintrin.h>
+    #if defined(_MSC_VER)
+        #include <intrin.h>
+        #define CRC32C_TARGET_SSE42
+    #else
+        // Lets use the instruction without building everything for SSE4.2
+        #define CRC32C_TARGET_SSE42 __attribute__((target("sse4.2")))
+    #endif
+#else
+    #define CRC32C_X86 (0)
+#endif
+
+// Reversed Castagnoli polynomial
+static const uint32_t Crc32CPoly = 0x82F63B78u;
+
+namespace
+{
+    // Lookup tables for the "slicing by 8": Table[0] is the classic byte
+    // table, and each next one advances the CRC by one more zero byte
+    struct Crc32CTables
+    {
+        uint32_t Table[8][256];
+
+        Crc32CTables()
+        {
+            for (uint32_t i = 0; i < 256; ++i)
+            {
+                uint32_t crc = i;
+                for (int bit = 0; bit < 8; ++bit)
+                    crc = (crc >> 1) ^ ((crc & 1) ? Crc32CPoly : 0u);
+                Table[0][i] = crc;
+            }
+            for (uint32_t i = 0; i < 256; ++i)
+            {
+                for (int k = 1; k < 8; ++k)
+                    Table[k][i] = (Table[k - 1][i] >> 8) ^ Table[0][Table[k - 1][i] & 0xFF];
+            }
+        }
+    };
+
+    const Crc32CTables &GetTables()
+    {
+        static const Crc32CTables tables;
+        return tables;
+    }
+
+    inline uint32_t LoadUInt32LE(const uint8_t *p)
+    {
+        return p[0] | (p[1] << 8) | (p[2] << 16) | (static_cast<uint32_t>(p[3]) << 24);
+    }
+}
+
+static uint32_t Crc32CUpdateTable(const uint8_t *p, size_t size, uint32_t crc)
+{
+    const Crc32CTables &t = GetTables();
+    for (; size >= 8; p += 8, size -= 8)
+    {
+        const uint32_t lo = crc ^ LoadUInt32LE(p);
+        const uint32_t hi = LoadUInt32LE(p + 4);
+        crc = t.Table[7][lo & 0xFF] ^ t.Table[6][(lo >> 8) & 0xFF] ^
+              t.Table[5][(lo >> 16) & 0xFF] ^ t.Table[4][lo >> 24] ^
+              t.Table[3][hi & 0xFF] ^ t.Table[2][(hi >> 8) & 0xFF] ^
+              t.Table[1][(hi >> 16) & 0xFF] ^ t.Table[0][hi >> 24];
+    }
+    for (; size > 0; ++p, --size)
+        crc = (crc >> 8) ^ t.Table[0][(crc ^ *p) & 0xFF];
+    return crc;
+}
+
+#if (CRC32C_X86)
+CRC32C_TARGET_SSE42
+static uint32_t Crc32CUpdateSSE42(const uint8_t *p, size_t size, uint32_t crc)
+{
+    // Bytes up to the word alignment, then whole words, then the rest
+    for (; size > 0 && (reinterpret_cast<uintptr_t>(p) & 7) != 0; ++p, --size)
+        crc = _mm_crc32_u8(crc, *p);
+#if defined(__x86_64__) || defined(_M_X64)
+    uint64_t crc64 = crc;
+    for (; size >= 8; p += 8, size -= 8)
+        crc64 = _mm_crc32_u64(crc64, *reinterpret_cast<const uint64_t*>(p));
+    crc = static_cast<uint32_t>(crc64);
+#else
+    for (; size >= 4; p += 4, size -= 4)
+        crc = _mm_crc32_u32(crc, *reinterpret_cast<const uint32_t*>(p));
+#endif
+    for (; size > 0; ++p, --size)
+        crc = _mm_crc32_u8(crc, *p);
+    return crc;
+}
+
+static bool DetectSSE42()
+{
+#if defined(_MSC_VER)
+    int info[4];
+    __cpuid(info, 1);
+    return (info[2] & (1 << 20)) != 0;
+#else
+    return __builtin_cpu_supports("sse4.2") != 0;
+#endif
+}
+#endif // CRC32C_X86
+
+bool Crc32CHasHardware()
+{
+#if (CRC32C_X86)
+    static const bool has_sse42 = DetectSSE42();
+    return has_sse42;
+#else
+    return false;
+#endif
+}
+
+uint32_t Crc32C(const void *data, size_t size, uint32_t crc)
+{
+#if (CRC32C_X86)
+    if (Crc32CHasHardware())
+        return ~Crc32CUpdateSSE42(static_cast<const uint8_t*>(data), size, ~crc);
+#endif
+    return ~Crc32CUpdateTable(static_cast<const uint8_t*>(data), size, ~crc);
+}
+
+uint32_t Crc32CSoftware(const void *data, size_t size, uint32_t crc)
+{
+    return ~Crc32CUpdateTable(static_cast<const uint8_t*>(data), size, ~crc);
+}
@@ -0,0 +1,24 @@
+//=============================================================================
+//
+// CRC32C (Castagnoli) checksum, meant for fingerprinting the data quickly.
+//
+// Uses the SSE4.2 CRC32 instruction when the CPU supports it, which is
+// checked once at runtime, and the table-driven "slicing by 8" otherwise.
+// Both give the same result on any platform, so the values may be stored.
+//
+//=============================================================================
+#ifndef COMMON_UTILS__CRC32C_H__
+#define COMMON_UTILS__CRC32C_H__
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Computes CRC32C of the data; crc is the result for the preceding data,
+// which lets compute it piece by piece
+uint32_t Crc32C(const void *data, size_t size, uint32_t crc = 0u);
+// Computes CRC32C using the lookup tables only
+uint32_t Crc32CSoftware(const void *data, size_t size, uint32_t crc = 0u);
+// Tells if Crc32C uses the hardware instruction on this CPU
+bool Crc32CHasHardware();
+
+#endif // COMMON_UTILS__CRC32C_H__
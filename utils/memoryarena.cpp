@@ -0,0 +1,48 @@
+#include "memoryarena.h"
+#include <algorithm>
+
+MemoryArena::MemoryArena(size_t chunk_size)
+    : _chunkSize(std::max<size_t>(chunk_size, 1u))
+{
+}
+
+void *MemoryArena::Allocate(size_t size, size_t align)
+{
+    for (; _chunk < _chunks.size(); ++_chunk, _offset = 0u)
+    {
+        Chunk &chunk = _chunks[_chunk];
+        const uintptr_t base = reinterpret_cast<uintptr_t>(chunk.Data.get());
+        const size_t offset = ((base + _offset + align - 1) & ~(uintptr_t)(align - 1)) - base;
+        if (offset <= chunk.Size && chunk.Size - offset >= size)
+        {
+            _offset = offset + size;
+            _used += size;
+            return chunk.Data.get() + offset;
+        }
+        // does not fit, the rest of this chunk is wasted until the reset
+    }
+
+    // Add a new chunk; larger allocations get a chunk of their own size
+    Chunk chunk;
+    chunk.Size = std::max(_chunkSize, size + align);
+    chunk.Data.reset(new uint8_t[chunk.Size]);
+    _chunks.push_back(std::move(chunk));
+    _chunk = _chunks.size() - 1;
+    _offset = 0u;
+    return Allocate(size, align);
+}
+
+void MemoryArena::Reset()
+{
+    _chunk = 0u;
+    _offset = 0u;
+    _used = 0u;
+}
+
+size_t MemoryArena::GetReserved() const
+{
+    size_t total = 0u;
+    for (const auto &chunk : _chunks)
+        total += chunk.Size;
+    return total;
+}
@@ -0,0 +1,56 @@
+//=============================================================================
+//
+// MemoryArena is a monotonic allocator: it hands out memory from large
+// chunks by advancing an offset, and never frees individual allocations.
+// All the memory is released at once with Reset(), which keeps the chunks
+// for reuse, so that an arena reused for similar loads stops allocating
+// from the heap after the first one.
+//
+// MemoryArena is not thread-safe; if the data allocated from it is filled
+// on several threads, then the allocations must be done beforehand.
+//
+//=============================================================================
+#ifndef COMMON_UTILS__MEMORYARENA_H__
+#define COMMON_UTILS__MEMORYARENA_H__
+
+#include <cstddef>
+#include <memory>
+#include <vector>
+#include <stdint.h>
+
+class MemoryArena
+{
+public:
+    static const size_t DefaultChunkSize = 1024u * 1024u;
+
+    MemoryArena(size_t chunk_size = DefaultChunkSize);
+
+    // Allocates size bytes with the given alignment; never returns null
+    void   *Allocate(size_t size, size_t align = alignof(std::max_align_t));
+    // Releases all the allocations at once, but keeps the chunks for reuse;
+    // all the memory given out before becomes invalid
+    void    Reset();
+
+    // Returns number of bytes given out since the last reset
+    size_t  GetUsed() const { return _used; }
+    // Returns total size of the chunks held by the arena
+    size_t  GetReserved() const;
+
+private:
+    MemoryArena(const MemoryArena&) = delete;
+    MemoryArena &operator=(const MemoryArena&) = delete;
+
+    struct Chunk
+    {
+        std::unique_ptr<uint8_t[]> Data;
+        size_t Size = 0u;
+    };
+
+    const size_t _chunkSize;
+    std::vector<Chunk> _chunks;
+    size_t _chunk = 0u; // current chunk
+    size_t _offset = 0u; // free space offset in the current chunk
+    size_t _used = 0u;
+};
+
+#endif // COMMON_UTILS__MEMORYARENA_H__
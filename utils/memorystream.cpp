@@ -159,6 +159,11 @@ void VectorStream::Close()
     MemoryStream::Close();
 }
 
+bool VectorStream::IsValid() const
+{
+    return _vec != nullptr || MemoryStream::IsValid();
+}
+
 bool VectorStream::CanRead() const
 {
     return _mode == kStream_Read;
@@ -73,6 +73,8 @@ public:
     VectorStream(std::vector<uint8_t> &buf, StreamMode mode);
     ~VectorStream() override = default;
 
+    // The writeable vector may be empty yet, and is still a valid stream
+    bool    IsValid() const override;
     bool    CanRead() const override;
     bool    CanWrite() const override;
 
@@ -0,0 +1,232 @@
+#include "sharedfilestream.h"
+#include <algorithm>
+#include <stdexcept>
+#include "platform.h"
+#include "compat_stdio.h"
+
+#if (PLATFORM_OS_WINDOWS)
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+#else
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+SharedFile::SharedFile(const std::string &path)
+    : _path(path)
+{
+#if (PLATFORM_OS_WINDOWS)
+    WCHAR wpath[MAX_PATH_SZ];
+    MultiByteToWideChar(CP_UTF8, 0, path.c_str(), -1, wpath, MAX_PATH_SZ);
+    HANDLE h = CreateFileW(wpath, GENERIC_READ, FILE_SHARE_READ, nullptr,
+        OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+    if (h == INVALID_HANDLE_VALUE)
+        throw std::runtime_error("Error opening file.");
+    LARGE_INTEGER size;
+    if (!GetFileSizeEx(h, &size))
+    {
+        CloseHandle(h);
+        throw std::runtime_error("Error opening file.");
+    }
+    _handle = h;
+    _length = static_cast<soff_t>(size.QuadPart);
+#else
+    int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0)
+        throw std::runtime_error("Error opening file.");
+    struct stat st;
+    if (fstat(fd, &st) != 0)
+    {
+        close(fd);
+        throw std::runtime_error("Error opening file.");
+    }
+    _fd = fd;
+    _length = static_cast<soff_t>(st.st_size);
+#endif
+}
+
+SharedFile::~SharedFile()
+{
+#if (PLATFORM_OS_WINDOWS)
+    if (_handle)
+        CloseHandle(static_cast<HANDLE>(_handle));
+#else
+    if (_fd >= 0)
+        close(_fd);
+#endif
+}
+
+std::shared_ptr<SharedFile> SharedFile::TryOpen(const std::string &path)
+{
+    try
+    {
+        return std::make_shared<SharedFile>(path);
+    }
+    catch (const std::runtime_error &)
+    {
+        return nullptr;
+    }
+}
+
+size_t SharedFile::ReadAt(void *buffer, size_t size, soff_t offset) const
+{
+    if (offset < 0 || offset >= _length)
+        return 0;
+    size = static_cast<size_t>(std::min<soff_t>(size, _length - offset));
+    uint8_t *dst = static_cast<uint8_t*>(buffer);
+    size_t total = 0;
+    while (total < size)
+    {
+#if (PLATFORM_OS_WINDOWS)
+        // Synchronous ReadFile with an OVERLAPPED offset does a positional read
+        OVERLAPPED ov = {};
+        const uint64_t pos = static_cast<uint64_t>(offset + total);
+        ov.Offset = static_cast<DWORD>(pos & 0xFFFFFFFF);
+        ov.OffsetHigh = static_cast<DWORD>(pos >> 32);
+        const DWORD chunk = static_cast<DWORD>(std::min<size_t>(size - total, 0x40000000));
+        DWORD was_read = 0;
+        if (!ReadFile(static_cast<HANDLE>(_handle), dst + total, chunk, &was_read, &ov) ||
+            was_read == 0)
+            break;
+        total += was_read;
+#else
+        ssize_t was_read = pread(_fd, dst + total, size - total, static_cast<off_t>(offset + total));
+        if (was_read < 0 && errno == EINTR)
+            continue;
+        if (was_read <= 0)
+            break;
+        total += static_cast<size_t>(was_read);
+#endif
+    }
+    return total;
+}
+
+
+SharedFileStream::SharedFileStream(const std::string &path)
+    : StreamBase(path)
+    , _file(std::make_shared<SharedFile>(path))
+{
+}
+
+SharedFileStream::SharedFileStream(std::shared_ptr<SharedFile> file)
+    : StreamBase(file ? file->GetPath() : std::string())
+    , _file(std::move(file))
+{
+}
+
+std::unique_ptr<SharedFileStream> SharedFileStream::TryOpen(const std::string &path)
+{
+    std::unique_ptr<SharedFileStream> fs;
+    try
+    {
+        fs.reset(new SharedFileStream(path));
+    }
+    catch (const std::runtime_error &)
+    {
+        fs = nullptr;
+    }
+    return fs;
+}
+
+std::unique_ptr<SharedFileStream> SharedFileStream::OpenCursor() const
+{
+    if (!_file)
+        return nullptr;
+    return std::unique_ptr<SharedFileStream>(new SharedFileStream(_file));
+}
+
+bool SharedFileStream::IsValid() const
+{
+    return _file != nullptr;
+}
+
+bool SharedFileStream::EOS() const
+{
+    return _eos;
+}
+
+soff_t SharedFileStream::GetLength() const
+{
+    return _file ? _file->GetLength() : 0;
+}
+
+soff_t SharedFileStream::GetPosition() const
+{
+    return _pos;
+}
+
+bool SharedFileStream::CanRead() const
+{
+    return IsValid();
+}
+
+bool SharedFileStream::CanWrite() const
+{
+    return false;
+}
+
+bool SharedFileStream::CanSeek() const
+{
+    return IsValid();
+}
+
+size_t SharedFileStream::Read(void *buffer, size_t size)
+{
+    if (!_file) { return 0; }
+    size_t was_read = _file->ReadAt(buffer, size, _pos);
+    _pos += was_read;
+    // conform to the stdio behavior: EOS is set after failing to read
+    _eos = was_read < size;
+    return was_read;
+}
+
+int32_t SharedFileStream::ReadByte()
+{
+    uint8_t b;
+    if (Read(&b, 1) != 1)
+        return -1;
+    return b;
+}
+
+size_t SharedFileStream::Write(const void * /*buffer*/, size_t /*size*/)
+{
+    return 0;
+}
+
+int32_t SharedFileStream::WriteByte(uint8_t /*val*/)
+{
+    return -1;
+}
+
+bool SharedFileStream::Seek(soff_t offset, StreamSeek origin)
+{
+    if (!_file) { return false; }
+    soff_t pos = 0;
+    switch (origin)
+    {
+    case kSeekBegin:    pos = 0 + offset; break;
+    case kSeekCurrent:  pos = _pos + offset; break;
+    case kSeekEnd:      pos = _file->GetLength() + offset; break;
+    default:
+        return false;
+    }
+    if (pos < 0)
+        return false;
+    _pos = pos;
+    _eos = false;
+    return true;
+}
+
+void SharedFileStream::Close()
+{
+    _file = nullptr;
+    _pos = 0;
+    _eos = false;
+}
+
+bool SharedFileStream::Flush()
+{
+    return true;
+}
@@ -0,0 +1,101 @@
+//=============================================================================
+//
+// Shared file stream implementation.
+//
+// SharedFile is a read-only file handle, which is read with positional
+// reads (pread and alike), and therefore has no shared file position.
+// File length is retrieved once, when the file is opened.
+//
+// SharedFileStream is a read-only stream over SharedFile, which keeps its
+// own cursor. Any number of streams may be created over the same
+// SharedFile, and used from different threads simultaneously, without
+// locking and without reopening the file.
+//
+//=============================================================================
+#ifndef COMMON_UTILS__SHAREDFILESTREAM_H__
+#define COMMON_UTILS__SHAREDFILESTREAM_H__
+
+#include "platform.h"
+#include "stream.h"
+
+class SharedFile
+{
+public:
+    // Opens a file for reading
+    // The constructor may raise std::runtime_error if there is an issue
+    // opening the file (does not exist, locked, permissions, etc)
+    SharedFile(const std::string &path);
+    ~SharedFile();
+
+    static std::shared_ptr<SharedFile> TryOpen(const std::string &path);
+
+    const std::string &GetPath() const { return _path; }
+    // Returns file length, as it was when the file was opened
+    soff_t  GetLength() const { return _length; }
+    // Reads up to size bytes at the given file offset;
+    // returns number of bytes read, which is less than size only if the
+    // end of file was reached, or an error occured.
+    // Safe to call from multiple threads.
+    size_t  ReadAt(void *buffer, size_t size, soff_t offset) const;
+#if !(PLATFORM_OS_WINDOWS)
+    // Returns native file descriptor, for use with the system I/O interfaces
+    int     GetDescriptor() const { return _fd; }
+#endif
+
+private:
+    SharedFile(const SharedFile&) = delete;
+    SharedFile &operator=(const SharedFile&) = delete;
+
+    const std::string _path;
+#if (PLATFORM_OS_WINDOWS)
+    void    *_handle = nullptr;
+#else
+    int     _fd = -1;
+#endif
+    soff_t  _length = 0;
+};
+
+
+class SharedFileStream : public StreamBase
+{
+public:
+    // Opens a file and creates a stream over it
+    // The constructor may raise std::runtime_error if there is an issue
+    // opening the file (does not exist, locked, permissions, etc)
+    SharedFileStream(const std::string &path);
+    // Creates a new stream with independent cursor over an open file
+    SharedFileStream(std::shared_ptr<SharedFile> file);
+    ~SharedFileStream() override = default;
+
+    static std::unique_ptr<SharedFileStream> TryOpen(const std::string &path);
+
+    // Returns the underlying shared file
+    const std::shared_ptr<SharedFile> &GetFile() const { return _file; }
+    // Creates a new stream with independent cursor over the same file
+    std::unique_ptr<SharedFileStream> OpenCursor() const;
+
+    bool    IsValid() const override;
+    bool    EOS() const override;
+    soff_t  GetLength() const override;
+    soff_t  GetPosition() const override;
+    bool    CanRead() const override;
+    bool    CanWrite() const override;
+    bool    CanSeek() const override;
+
+    size_t  Read(void *buffer, size_t size) override;
+    int32_t ReadByte() override;
+    size_t  Write(const void *buffer, size_t size) override;
+    int32_t WriteByte(uint8_t b) override;
+
+    bool    Seek(soff_t offset, StreamSeek origin) override;
+
+    void    Close() override;
+    bool    Flush() override;
+
+private:
+    std::shared_ptr<SharedFile> _file;
+    soff_t  _pos = 0;
+    bool    _eos = false;
+};
+
+#endif // COMMON_UTILS__SHAREDFILESTREAM_H__
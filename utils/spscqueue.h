@@ -0,0 +1,123 @@
+//=============================================================================
+//
+// Bounded single-producer single-consumer queue.
+//
+// The queue is a ring buffer of fixed capacity, where the producer only
+// moves the tail, and the consumer only moves the head, so neither of them
+// takes a lock. Push waits while the queue is full, which holds back the
+// producer when the consumer falls behind; Pop waits while the queue is
+// empty. Waiting threads spin shortly, and then sleep in small steps.
+//
+// Exactly one thread may push, and exactly one thread may pop.
+//
+//=============================================================================
+#ifndef COMMON_UTILS__SPSCQUEUE_H__
+#define COMMON_UTILS__SPSCQUEUE_H__
+
+#include <atomic>
+#include <chrono>
+#include <thread>
+#include <vector>
+
+// Waits with increasing pauses
+class SpinBackoff
+{
+public:
+    void Pause()
+    {
+        if (_spins < YieldSpins)
+        {
+            _spins++;
+            std::this_thread::yield();
+        }
+        else
+        {
+            std::this_thread::sleep_for(std::chrono::microseconds(static_cast<long>(SleepMicroseconds)));
+        }
+    }
+
+private:
+    static const unsigned YieldSpins = 64u;
+    static const unsigned SleepMicroseconds = 50u;
+    unsigned _spins = 0u;
+};
+
+template <typename T>
+class SpscQueue
+{
+public:
+    // Creates a queue; the capacity is rounded up to a power of two
+    SpscQueue(size_t capacity)
+    {
+        size_t size = 2u;
+        while (size < capacity)
+            size *= 2u;
+        _items.resize(size);
+        _mask = size - 1u;
+    }
+
+    size_t GetCapacity() const { return _items.size(); }
+
+    // Producer: adds an item if there's free space
+    bool TryPush(T &item)
+    {
+        const size_t tail = _tail.load(std::memory_order_relaxed);
+        if (tail - _head.load(std::memory_order_acquire) == _items.size())
+            return false;
+        _items[tail & _mask] = std::move(item);
+        _tail.store(tail + 1u, std::memory_order_release);
+        return true;
+    }
+
+    // Producer: adds an item, waits until there's free space
+    void Push(T item)
+    {
+        SpinBackoff backoff;
+        while (!TryPush(item))
+            backoff.Pause();
+    }
+
+    // Producer: tells that no more items will be pushed
+    void Close() { _closed.store(true, std::memory_order_release); }
+
+    // Consumer: takes an item if there's one
+    bool TryPop(T &item)
+    {
+        const size_t head = _head.load(std::memory_order_relaxed);
+        if (head == _tail.load(std::memory_order_acquire))
+            return false;
+        item = std::move(_items[head & _mask]);
+        _items[head & _mask] = T(); // release resources held by the item now
+        _head.store(head + 1u, std::memory_order_release);
+        return true;
+    }
+
+    // Consumer: takes an item, waits until there's one; returns false if
+    // the queue is closed and all the items were taken
+    bool Pop(T &item)
+    {
+        SpinBackoff backoff;
+        while (!TryPop(item))
+        {
+            // Closed queue may get no more items, but those pushed before
+            // closing must be taken first
+            if (_closed.load(std::memory_order_acquire))
+                return TryPop(item);
+            backoff.Pause();
+        }
+        return true;
+    }
+
+private:
+    SpscQueue(const SpscQueue&) = delete;
+    SpscQueue &operator=(const SpscQueue&) = delete;
+
+    std::vector<T> _items;
+    size_t _mask = 0u;
+    // Positions only grow, and are wrapped by the mask when used
+    std::atomic<size_t> _head { 0u }; // next item to pop, written by the consumer
+    std::atomic<size_t> _tail { 0u }; // next item to push, written by the producer
+    std::atomic<bool> _closed { false };
+};
+
+#endif // COMMON_UTILS__SPSCQUEUE_H__
@@ -7,6 +7,7 @@
 #ifndef COMMON_UTILS__STREAM_H__
 #define COMMON_UTILS__STREAM_H__
 
+#include <algorithm>
 #include <memory>
 #include <string>
 #include "bbop.h"
@@ -133,6 +134,20 @@ public:
         return BBOp::Int64FromLE(val);
     }
 
+    // Reads an array of count values, returns number of values read
+    size_t ReadArrayInt16LE(int16_t *buffer, size_t count)
+    {
+        count = Read(buffer, count * sizeof(int16_t)) / sizeof(int16_t);
+        BBOp::Int16ArrayFromLE(buffer, count);
+        return count;
+    }
+    size_t ReadArrayInt32LE(int32_t *buffer, size_t count)
+    {
+        count = Read(buffer, count * sizeof(int32_t)) / sizeof(int32_t);
+        BBOp::Int32ArrayFromLE(buffer, count);
+        return count;
+    }
+
     size_t WriteInt8(int8_t val)
     {
         return Write(&val, sizeof(int8_t));
@@ -153,8 +168,49 @@ public:
         return Write(&val, sizeof(int64_t));
     }
 
+    // Writes an array of count values, returns number of values written
+    size_t WriteArrayInt16LE(const int16_t *buffer, size_t count)
+    {
+#if defined (BITBYTE_BIG_ENDIAN)
+        return WriteArraySwapped(buffer, count, BBOp::SwapBytesArrayInt16);
+#else
+        return Write(buffer, count * sizeof(int16_t)) / sizeof(int16_t);
+#endif
+    }
+    size_t WriteArrayInt32LE(const int32_t *buffer, size_t count)
+    {
+#if defined (BITBYTE_BIG_ENDIAN)
+        return WriteArraySwapped(buffer, count, BBOp::SwapBytesArrayInt32);
+#else
+        return Write(buffer, count * sizeof(int32_t)) / sizeof(int32_t);
+#endif
+    }
+
 protected:
     std::unique_ptr<StreamBase> _base;
+
+private:
+#if defined (BITBYTE_BIG_ENDIAN)
+    // Writes array with bytes swapped, using a temporary buffer;
+    // the input array is kept unchanged
+    template <typename T>
+    size_t WriteArraySwapped(const T *buffer, size_t count, void (*swap)(T*, size_t))
+    {
+        T temp[256];
+        size_t written = 0;
+        while (written < count)
+        {
+            const size_t n = std::min(count - written, sizeof(temp) / sizeof(T));
+            std::copy(buffer + written, buffer + written + n, temp);
+            swap(temp, n);
+            const size_t was_written = Write(temp, n * sizeof(T)) / sizeof(T);
+            written += was_written;
+            if (was_written < n)
+                break;
+        }
+        return written;
+    }
+#endif
 };
 
 #endif // COMMON_UTILS__STREAM_H__
@@ -0,0 +1,62 @@
+#include "threadpool.h"
+
+ThreadPool::ThreadPool(unsigned thread_count)
+{
+    if (thread_count == 0)
+        thread_count = GetDefaultThreadCount();
+    for (unsigned i = 0; i < thread_count; ++i)
+        _threads.emplace_back(&ThreadPool::Run, this);
+}
+
+ThreadPool::~ThreadPool()
+{
+    {
+        std::unique_lock<std::mutex> lk(_mutex);
+        _idleCond.wait(lk, [this] { return _tasks.empty() && _busy == 0; });
+        _stop = true;
+    }
+    _taskCond.notify_all();
+    for (auto &t : _threads)
+        t.join();
+}
+
+unsigned ThreadPool::GetDefaultThreadCount()
+{
+    unsigned count = std::thread::hardware_concurrency();
+    return count > 0 ? count : 1u;
+}
+
+void ThreadPool::Post(std::function<void()> task)
+{
+    {
+        std::lock_guard<std::mutex> lk(_mutex);
+        _tasks.push_back(std::move(task));
+    }
+    _taskCond.notify_one();
+}
+
+void ThreadPool::Wait()
+{
+    std::unique_lock<std::mutex> lk(_mutex);
+    _idleCond.wait(lk, [this] { return _tasks.empty() && _busy == 0; });
+}
+
+void ThreadPool::Run()
+{
+    std::unique_lock<std::mutex> lk(_mutex);
+    for (;;)
+    {
+        _taskCond.wait(lk, [this] { return _stop || !_tasks.empty(); });
+        if (_tasks.empty())
+            return; // stopped
+        auto task = std::move(_tasks.front());
+        _tasks.pop_front();
+        _busy++;
+        lk.unlock();
+        task();
+        lk.lock();
+        _busy--;
+        if (_tasks.empty() && _busy == 0)
+            _idleCond.notify_all();
+    }
+}
@@ -0,0 +1,51 @@
+//=============================================================================
+//
+// Simple thread pool, which runs posted tasks on a fixed number of worker
+// threads, in the order of posting.
+//
+//=============================================================================
+#ifndef COMMON_UTILS__THREADPOOL_H__
+#define COMMON_UTILS__THREADPOOL_H__
+
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+class ThreadPool
+{
+public:
+    // Starts the pool with the given number of worker threads;
+    // 0 means the number of hardware threads
+    ThreadPool(unsigned thread_count = 0u);
+    // Waits for all the posted tasks to complete, and stops the threads
+    ~ThreadPool();
+
+    // Returns a number of threads used by default
+    static unsigned GetDefaultThreadCount();
+
+    unsigned GetThreadCount() const { return static_cast<unsigned>(_threads.size()); }
+
+    // Posts a task for execution on any of the worker threads
+    void Post(std::function<void()> task);
+    // Waits until all the posted tasks are complete
+    void Wait();
+
+private:
+    ThreadPool(const ThreadPool&) = delete;
+    ThreadPool &operator=(const ThreadPool&) = delete;
+
+    void Run();
+
+    std::vector<std::thread> _threads;
+    std::deque<std::function<void()>> _tasks;
+    std::mutex _mutex;
+    std::condition_variable _taskCond; // signals new task or stop
+    std::condition_variable _idleCond; // signals that all tasks are done
+    unsigned _busy = 0u; // number of tasks being run
+    bool _stop = false;
+};
+
+#endif // COMMON_UTILS__THREADPOOL_H__
@@ -3,9 +3,23 @@
 #include <string>
 #include <string.h>
 #include <vector>
+#include "uwsav/uwsav_archive.h"
+#include "uwsav/uwsav_atlas.h"
+#include "uwsav/uwsav_batch.h"
 #include "uwsav/uwsav_data.h"
+#include "uwsav/uwsav_filter.h"
+#include "uwsav/uwsav_histogram.h"
+#include "uwsav/uwsav_history.h"
+#include "uwsav/uwsav_pipeline.h"
+#include "uwsav/uwsav_query.h"
+#include "uwsav/uwsav_slots.h"
+#include "uwsav/uwsav_validate.h"
+#include "uwsav/uwsav_writer.h"
 #include "utils/platform.h"
+#include "utils/chunkedstream.h"
 #include "utils/filestream.h"
+#include "utils/memorystream.h"
+#include "utils/sharedfilestream.h"
 #include "utils/stream.h"
 #include "utils/str_utils.h"
 
@@ -93,8 +107,7 @@ void print_objlinkedlist(Stream &out, const LevelData &level,
 
         const ObjectData& obj = level.objs[obj_index];
         // NPCs or containers: save for later
-        if ((obj.ItemID >= 0x0040 && obj.ItemID <= 0x007f) ||
-            (obj.ItemID >= 0x0080 && obj.ItemID <= 0x008f))
+        if (IsNpcItem(obj.ItemID) || IsContainerItem(obj.ItemID))
         {
             containers.push_back(obj_index);
         }
@@ -118,7 +131,7 @@ void print_objlinkedlist(Stream &out, const LevelData &level,
     for (auto cont_index : containers)
     {
         const ObjectData &obj = level.objs[cont_index];
-        const char *tag = (obj.ItemID >= 0x0040 && obj.ItemID <= 0x007f) ? "npc" : "inv";
+        const char *tag = IsNpcItem(obj.ItemID) ? "npc" : "inv";
         const char *has_inv = (obj.SpecialLink > 0) ? "+" : "-";
         const char *has_inv2 = (obj.SpecialLink > 0) ? ":" : " ";
         write_text(out, indent + ">>  " + StrPrint(" 0x%03x (%s%s)%s ", obj.ItemID, has_inv, tag, has_inv2));
@@ -166,29 +179,388 @@ void print_objlist(Stream &out, const LevelData &level)
     out.Seek(end_pos, kSeekBegin);
 }
 
+// Prints NPC list
+void print_npclist(Stream &out, const LevelData &level)
+{
+    static const char *attitude_names[] = { "hostile", "upset", "mellow", "friendly" };
+    NpcColumns npcs;
+    AppendNpcColumns(level, npcs);
+    write_text_ln(out, "--------------------------------------------------------------------");
+    write_text_ln(out, StrPrint("  NPCs: %d", static_cast<int>(npcs.GetCount())));
+    write_text_ln(out, "  Obj   | Item  | HP  | Lvl | Attitude | Goal | Target | Home  | Whoami");
+    for (size_t i = 0; i < npcs.GetCount(); ++i)
+    {
+        write_text_ln(out, StrPrint("  0x%03x | 0x%03x | %3u | %3u | %-8s | %4u | %6u | %02u,%02u | %u",
+            npcs.ObjIndex[i], npcs.ItemID[i], npcs.HP[i], npcs.Level[i],
+            attitude_names[npcs.Attitude[i] & 3], npcs.Goal[i], npcs.GoalTarget[i],
+            npcs.XHome[i], npcs.YHome[i], npcs.WhoAmI[i]));
+    }
+}
+
+// Prints automap, showing the tiles seen by the player
+void print_automap(Stream &out, const AutomapData &automap)
+{
+    write_text_ln(out, "--------------------------------------------------------------------");
+    write_text_ln(out, StrPrint("  Automap: seen %d / %d tiles",
+        static_cast<int>(automap.CountSeen()), LevelData::Width * LevelData::Height));
+    write_text_ln(out, "   0000000000111111111122222222223333333333444444444455555555556666");
+    write_text_ln(out, "   0123456789012345678901234567890123456789012345678901234567890123");
+    write_text_ln(out, "  -----------------------------------------------------------------");
+
+    std::string line;
+    for (uint16_t y = 0; y < LevelData::Height; ++y)
+    {
+        uint16_t uw_y = LevelData::Height - y - 1; // y axis is inverse
+        line = StrPrint("%02d|", uw_y);
+        for (uint16_t x = 0; x < LevelData::Width; ++x)
+            line.append(automap.IsSeen(x, uw_y) ? "+" : " ");
+        line.append("|");
+        write_text_ln(out, line);
+    }
+
+    write_text_ln(out, "  -----------------------------------------------------------------");
+}
+
+// Prints map notes
+void print_mapnotes(Stream &out, const std::vector<MapNote> &notes)
+{
+    write_text_ln(out, "--------------------------------------------------------------------");
+    write_text_ln(out, StrPrint("  Map notes: %d", static_cast<int>(notes.size())));
+    for (const auto &note : notes)
+        write_text_ln(out, StrPrint("  (%3d,%3d) %s", note.X, note.Y, note.Text.c_str()));
+}
+
+const char *block_kind_to_string(BlockKind kind)
+{
+    switch (kind)
+    {
+    case kBlockLevel: return "level";
+    case kBlockAnimOverlay: return "animation";
+    case kBlockTextureMap: return "textures";
+    case kBlockAutomap: return "automap";
+    case kBlockMapNotes: return "map notes";
+    case kBlockUnknown: return "unknown";
+    default: return "unused";
+    }
+}
+
+// Prints used blocks of the archive with their fingerprints
+void print_fingerprints(Stream &out, LevelArchive &archive)
+{
+    if (!archive.ReadFingerprints())
+        write_text_ln(out, " Failed to read some of the archive blocks");
+    write_text_ln(out, "------------------------------------------------------------------------");
+    write_text_ln(out, "  Block | Kind      | World | Level | Offset   | Size   | CRC32C");
+    for (const auto &block : archive.GetBlocks())
+    {
+        if (block.Kind == kBlockUnused)
+            continue;
+        write_text_ln(out, StrPrint("  %5u | %-9s | %5d | %5d | %08x | %6u | %08x",
+            block.Block.Index, block_kind_to_string(block.Kind), block.WorldID, block.LevelID,
+            block.Block.Offset, block.Block.Size, block.Fingerprint));
+    }
+}
+
+// Formats the location of an object link
+std::string link_to_string(const ObjectLink &link)
+{
+    switch (link.Kind)
+    {
+    case kLinkTile:
+        return StrPrint("tile %d,%d", link.Source % LevelData::Width, link.Source / LevelData::Width);
+    case kLinkNext:
+        return StrPrint("0x%03x next", link.Source);
+    case kLinkSpecial:
+        return StrPrint("0x%03x special", link.Source);
+    default:
+        return "none";
+    }
+}
+
+// Prints object graph issues, each with the link where it was found
+void print_validation(Stream &out, const LevelData &level)
+{
+    write_text_ln(out, "--------------------------------------------------------------------");
+    std::vector<GraphIssue> issues;
+    ValidateObjectGraph(level, issues);
+    if (issues.empty())
+    {
+        write_text_ln(out, "  Object graph: ok");
+        return;
+    }
+    write_text_ln(out, StrPrint("  Object graph: %d issue(s)", static_cast<int>(issues.size())));
+    for (const auto &issue : issues)
+    {
+        const std::string link = link_to_string(issue.Link);
+        const std::string parent = link_to_string(issue.Parent);
+        switch (issue.Kind)
+        {
+        case kIssueOutOfRange:
+            write_text_ln(out, StrPrint("    Link out of range: %s -> 0x%03x", link.c_str(), issue.Target));
+            break;
+        case kIssueFreeSlot:
+            write_text_ln(out, StrPrint("    Link to free slot: %s -> 0x%03x", link.c_str(), issue.Target));
+            break;
+        case kIssueLoop:
+            write_text_ln(out, StrPrint("    Loop:              %s -> 0x%03x, first linked from %s",
+                link.c_str(), issue.Target, parent.c_str()));
+            break;
+        case kIssueSharedObject:
+            write_text_ln(out, StrPrint("    Shared object:     %s -> 0x%03x, first linked from %s",
+                link.c_str(), issue.Target, parent.c_str()));
+            break;
+        case kIssueLeakedSlot:
+            write_text_ln(out, StrPrint("    Leaked slot:       0x%03x (item 0x%03x)",
+                issue.Target, level.objs[issue.Target].ItemID));
+            break;
+        }
+    }
+}
+
+// Prints object slots usage, according to the level's free lists
+void print_slots(Stream &out, const LevelData &level)
+{
+    write_text_ln(out, "--------------------------------------------------------------------");
+    ObjectSlotSet allocated, linked;
+    if (!GetAllocatedSlots(level, allocated))
+    {
+        write_text_ln(out, "  Slots: no free lists in data");
+        return;
+    }
+    const SlotCount used = CountSlots(allocated);
+    write_text_ln(out, StrPrint("  Slots used: %04d / %04d (%05.2f%%)",
+        static_cast<int>(used.Total()), LevelData::MaxObjects, used.Total() * 100.f / LevelData::MaxObjects));
+    write_text_ln(out, StrPrint("  Mobile:     %04d / %04d (%05.2f%%)",
+        static_cast<int>(used.Mobile), LevelData::MaxMobiles, used.Mobile * 100.f / LevelData::MaxMobiles));
+    write_text_ln(out, StrPrint("  Static:     %04d / %04d (%05.2f%%)",
+        static_cast<int>(used.Static), LevelData::MaxStatic, used.Static * 100.f / LevelData::MaxStatic));
+
+    // Leaked slots are allocated, but not linked from anywhere; the opposite
+    // are objects linked on map, but having their slots free. The full walk
+    // over the object chains is left to the --validate.
+    GetLinkedSlots(level, allocated, linked);
+    const ObjectSlotSet leaked = allocated & ~linked;
+    const ObjectSlotSet linked_free = linked & ~allocated;
+    const struct { const char *Title; const ObjectSlotSet &Slots; } lists[] = {
+        { "Leaked", leaked }, { "Linked but free", linked_free } };
+    for (const auto &list : lists)
+    {
+        std::string line = StrPrint("  %s: %d", list.Title, static_cast<int>(list.Slots.count()));
+        for (size_t i = 0; i < list.Slots.size(); ++i)
+        {
+            if (!list.Slots.test(i))
+                continue;
+            if (line.size() >= 80)
+            {
+                write_text_ln(out, line);
+                line = "   ";
+            }
+            line.append(StrPrint(" 0x%03x", static_cast<int>(i)));
+        }
+        write_text_ln(out, line);
+    }
+}
+
+// Prints objects found by a spatial query
+void print_query_result(Stream &out, const LevelData &level, const std::string &title,
+                        const std::vector<ObjectLocation> &found)
+{
+    write_text_ln(out, "--------------------------------------------------------------------");
+    write_text_ln(out, StrPrint("  %s: %d", title.c_str(), static_cast<int>(found.size())));
+    for (const auto &loc : found)
+    {
+        const ObjectData &obj = level.objs[loc.ObjIndex];
+        write_text_ln(out, StrPrint("  0x%03x | 0x%03x | tile %02d,%02d | pos %d,%d,%3d",
+            loc.ObjIndex, obj.ItemID,
+            loc.X / ObjectSpatialIndex::TileUnits, loc.Y / ObjectSpatialIndex::TileUnits,
+            obj.XPos, obj.YPos, obj.ZPos));
+    }
+}
+
+// Prints objects matching the filter expression
+void print_filter_result(Stream &out, const LevelData &level, const ObjectFilter &filter)
+{
+    std::vector<ObjectContext> found;
+    FindObjects(level, filter, found);
+    write_text_ln(out, "--------------------------------------------------------------------");
+    write_text_ln(out, StrPrint("  Objects where %s: %d", filter.GetExpression().c_str(), static_cast<int>(found.size())));
+    for (const auto &ctx : found)
+    {
+        const ObjectData &obj = level.objs[ctx.ObjIndex];
+        std::string line = StrPrint("  0x%03x | 0x%03x | tile %02d,%02d | qty %3u",
+            ctx.ObjIndex, obj.ItemID, ctx.TileX, ctx.TileY, obj.Quantity);
+        if (ctx.Parent > 0)
+            line.append(StrPrint(" | in 0x%03x (0x%03x)", ctx.Parent, level.objs[ctx.Parent].ItemID));
+        write_text_ln(out, line);
+    }
+}
+
 struct CommandOptions
 {
     bool PrintHelp = false;
-    bool UW2 = false; // read as Ultima Underworld 2
+    GameType Game = kGameUnknown; // game forced by user, detected by default
     bool PrintMaps = true;
     bool PrintObjs = false;
+    bool PrintNpcs = false;
+    bool PrintAutomap = false;
+    bool PrintMapNotes = false;
+    bool PrintSlots = false;
+    bool Validate = false;
+    bool PrintFingerprints = false;
+    // Spatial queries; positions are in tiles
+    bool QueryNear = false;
+    float NearX = 0.f, NearY = 0.f, NearRadius = 0.f;
+    bool QueryTiles = false;
+    int TileX0 = 0, TileY0 = 0, TileX1 = 0, TileY1 = 0;
+    // Object filter
+    bool QueryWhere = false;
+    ObjectFilter Where;
+    bool Histogram = false; // count items of all inputs instead of printing them
+    // Save history pack
+    bool Pack = false; // pack the input archives instead of printing them
+    int Snapshot = -1; // snapshot to print from the input pack
+    int SnapshotLevel = -1; // only level to print from the snapshot
+    // Image atlas
+    bool Atlas = false; // draw the input archives' maps instead of printing them
+    AtlasOptions AtlasOpts;
+    // Repacking
+    bool Repack = false; // write the input archive with its levels packed anew
+    int RepackLevel = UW2BlockEncoder::DefaultLevel; // compression level
+
+    // Tells if printing needs other blocks besides the level data
+    bool NeedsArchive() const { return PrintAutomap || PrintMapNotes || PrintFingerprints; }
 };
 
-void print_levels(Stream &out, const std::vector<LevelData> &levels, const CommandOptions &opts)
+// Prints ItemID histogram, only the items that were found
+void print_histogram(Stream &out, const ItemHistogram &hist, size_t archive_num, size_t failed_num)
 {
-    for (const auto &level : levels)
+    write_text_ln(out, "==========================================");
+    write_text_ln(out, StrPrint(" Item histogram: %d archives (%d failed), %d levels",
+        static_cast<int>(archive_num), static_cast<int>(failed_num), static_cast<int>(hist.LevelCount)));
+    write_text_ln(out, "--------------------------------------------------------------------");
+    write_text_ln(out, "  Item  | Total    | Tiles    | Contain. | NPCs     | Quantity");
+    for (size_t item = 0; item < ItemHistogram::BinCount; ++item)
     {
-        write_text_ln(out, "==========================================");
+        const uint64_t total = hist.GetTotal(item);
+        if (total == 0)
+            continue;
+        write_text_ln(out, StrPrint("  0x%03x | %8llu | %8llu | %8llu | %8llu | %llu",
+            static_cast<int>(item), static_cast<unsigned long long>(total),
+            static_cast<unsigned long long>(hist.OnMap[item]),
+            static_cast<unsigned long long>(hist.InContainer[item]),
+            static_cast<unsigned long long>(hist.InNpc[item]),
+            static_cast<unsigned long long>(hist.Quantity[item])));
+    }
+}
 
-        if (level.WorldID > 0)
-            write_text_ln(out, StrPrint(" World %d, Level %d", level.WorldID, level.LevelID));
-        else
-            write_text_ln(out, StrPrint(" Level %d", level.LevelID));
+// Prints level data, and the level's other blocks read from the archive, if requested
+void print_level(Stream &out, const LevelData &level, const CommandOptions &opts,
+                 LevelArchive *archive)
+{
+    write_text_ln(out, "==========================================");
+
+    if (level.WorldID > 0)
+        write_text_ln(out, StrPrint(" World %d, Level %d", level.WorldID, level.LevelID));
+    else
+        write_text_ln(out, StrPrint(" Level %d", level.LevelID));
+
+    if (opts.PrintMaps)
+        print_tilemap(out, level);
+    if (opts.PrintObjs)
+        print_objlist(out, level);
+    if (opts.PrintNpcs)
+        print_npclist(out, level);
+    if (opts.PrintSlots)
+        print_slots(out, level);
+    if (opts.Validate)
+        print_validation(out, level);
+    if (opts.QueryNear || opts.QueryTiles)
+    {
+        ObjectSpatialIndex index(level);
+        std::vector<ObjectLocation> found;
+        if (opts.QueryNear)
+        {
+            const int units = ObjectSpatialIndex::TileUnits;
+            index.QueryRadius(static_cast<int>(opts.NearX * units), static_cast<int>(opts.NearY * units),
+                              static_cast<int>(opts.NearRadius * units), found);
+            print_query_result(out, level, StrPrint("Objects near %.2f,%.2f within %.2f",
+                opts.NearX, opts.NearY, opts.NearRadius), found);
+        }
+        if (opts.QueryTiles)
+        {
+            found.clear();
+            index.QueryTiles(opts.TileX0, opts.TileY0, opts.TileX1, opts.TileY1, found);
+            print_query_result(out, level, StrPrint("Objects in tiles %d,%d - %d,%d",
+                opts.TileX0, opts.TileY0, opts.TileX1, opts.TileY1), found);
+        }
+    }
+    if (opts.QueryWhere)
+        print_filter_result(out, level, opts.Where);
+    if (!archive)
+        return;
 
-        if (opts.PrintMaps)
-            print_tilemap(out, level);
-        if (opts.PrintObjs)
-            print_objlist(out, level);
+    const ArchiveBlockInfo *block;
+    if (opts.PrintAutomap &&
+        (block = archive->FindBlock(kBlockAutomap, level.WorldID, level.LevelID)) != nullptr)
+    {
+        AutomapData automap;
+        if (archive->ReadAutomap(*block, automap))
+            print_automap(out, automap);
+    }
+    if (opts.PrintMapNotes &&
+        (block = archive->FindBlock(kBlockMapNotes, level.WorldID, level.LevelID)) != nullptr)
+    {
+        std::vector<MapNote> notes;
+        if (archive->ReadMapNotes(*block, notes))
+            print_mapnotes(out, notes);
+    }
+}
+
+void print_levels(Stream &out, const std::vector<SharedLevel> &levels, const CommandOptions &opts,
+                  LevelArchive *archive)
+{
+    for (const auto &level : levels)
+        print_level(out, *level, opts, archive);
+}
+
+// Prints levels of the history pack's snapshot; reads only the requested
+// level, unless the other blocks are requested too
+void print_snapshot(Stream &out, Stream &in, const CommandOptions &opts)
+{
+    HistoryPackReader pack(in);
+    if (!pack.IsValid())
+    {
+        write_text_ln(out, "Failed to read the save history pack");
+        return;
+    }
+    const size_t snapshot = static_cast<size_t>(opts.Snapshot);
+    if (snapshot >= pack.GetSnapshotCount())
+    {
+        write_text_ln(out, StrPrint("Snapshot %d not found, the pack has %d snapshots",
+            opts.Snapshot, static_cast<int>(pack.GetSnapshotCount())));
+        return;
+    }
+    write_text_ln(out, StrPrint(" Snapshot %d: %s", opts.Snapshot, pack.GetSnapshotName(snapshot).c_str()));
+
+    std::vector<uint8_t> arc_data;
+    std::unique_ptr<Stream> arc_in;
+    std::unique_ptr<LevelArchive> archive;
+    if (opts.NeedsArchive() && pack.ReadArchive(snapshot, arc_data))
+    {
+        arc_in.reset(new Stream(std::unique_ptr<StreamBase>(new VectorStream(arc_data))));
+        archive.reset(new LevelArchive(*arc_in, pack.GetGame()));
+        if (opts.PrintFingerprints)
+            print_fingerprints(out, *archive);
+    }
+    std::vector<LevelBlockInfo> level_blocks;
+    pack.ReadLevelDirectory(snapshot, level_blocks);
+    for (size_t i = 0; i < level_blocks.size(); ++i)
+    {
+        if (opts.SnapshotLevel >= 0 && i != static_cast<size_t>(opts.SnapshotLevel))
+            continue;
+        LevelData level;
+        if (pack.ReadLevel(snapshot, i, level))
+            print_level(out, level, opts, archive.get());
     }
 }
 
@@ -196,15 +568,47 @@ void print_help()
 {
     printf(
 #if (PLATFORM_OS_WINDOWS)
-    "Usage: uwsav-dump.exe [OPTIONS] <input-lvl.ark> <output-text-file>\n"
+    "Usage: uwsav-dump.exe [OPTIONS] <input-lvl.ark> [<input-lvl.ark> ...] <output-text-file>\n"
 #else
-    "Usage: uwsav-dump [OPTIONS] <input-lvl.ark> <output-text-file>\n"
+    "Usage: uwsav-dump [OPTIONS] <input-lvl.ark> [<input-lvl.ark> ...] <output-text-file>\n"
 #endif
     //--------------------------------------------------------------------------------|
      "\nOptions:\n"
      "   -?, --help     print this help message and stop\n"
+     "   -uw1           assume \"Ultima Underworld 1\" data\n"
      "   -uw2           assume \"Ultima Underworld 2\" data\n"
+     "                  (by default the game is detected by the archive header)\n"
      "   -po            print map's objects list\n"
+     "   -pnpc          print map's NPC list\n"
+     "   -pa            print map's automap (tiles seen by player)\n"
+     "   -pm            print map's notes\n"
+     "   --slots        print map's object slots usage and leaked slots\n"
+     "   --validate     check map's object links, print every broken link found\n"
+     "   --fingerprints print archive's blocks with the CRC32C of their data\n"
+     "   --near=X,Y,R   print map's objects within R tiles from the X,Y position\n"
+     "                  (given in tiles, may be fractional)\n"
+     "   --tiles=X0,Y0,X1,Y1\n"
+     "                  print map's objects lying in the rectangle of tiles\n"
+     "   --where=EXPR   print map's objects matching the expression, e.g.\n"
+     "                  \"item in 0x080..0x08f and quantity > 10 and inside npc\"\n"
+     "                  (see uwsav/uwsav_filter.h for the syntax)\n"
+     "   --histogram    count map's objects by ItemID over all the input archives,\n"
+     "                  print only the totals instead of the maps\n"
+     "   --pack         store the input archives into the output file as a save\n"
+     "                  history pack, in the given order, instead of printing\n"
+     "   --snapshot=N[,L]\n"
+     "                  input is a save history pack, print its snapshot N;\n"
+     "                  optionally print only its level L (counting from 0)\n"
+     "   --atlas        draw the maps of all the input archives into the output file\n"
+     "                  as a PPM image, a row of levels per archive\n"
+     "   --tile-size=N  atlas tile side in pixels, 1-16 (default 4)\n"
+     "   --tile-color=T,RRGGBB\n"
+     "                  atlas colour of the tile type T (0-9, or 10 for unknown)\n"
+     "   --overlay=LIST atlas overlays, comma-separated: doors, objects, all (default)\n"
+     "                  or none\n"
+     "   --repack[=N]   write the input archive into the output file, with all its\n"
+     "                  levels packed anew; UW2 compressed levels are compressed with\n"
+     "                  the level N, 0 (store) to 9 (best), default 6\n"
     //--------------------------------------------------------------------------------|
      "\nExample:\n"
 #if (PLATFORM_OS_WINDOWS)
@@ -230,14 +634,94 @@ int main(int argc, char **argv)
     {
         if (strcmp(argv[argi], "-?") == 0 || strcmp(argv[argi], "--help") == 0)
             opts.PrintHelp = true;
+        if (strcmp(argv[argi], "-uw1") == 0)
+            opts.Game = kGameUW1;
         if (strcmp(argv[argi], "-uw2") == 0)
-            opts.UW2 = true;
+            opts.Game = kGameUW2;
         if (strcmp(argv[argi], "-po") == 0)
             opts.PrintObjs = true;
+        if (strcmp(argv[argi], "-pnpc") == 0)
+            opts.PrintNpcs = true;
+        if (strcmp(argv[argi], "-pa") == 0)
+            opts.PrintAutomap = true;
+        if (strcmp(argv[argi], "-pm") == 0)
+            opts.PrintMapNotes = true;
+        if (strcmp(argv[argi], "--slots") == 0)
+            opts.PrintSlots = true;
+        if (strcmp(argv[argi], "--validate") == 0)
+            opts.Validate = true;
+        if (strcmp(argv[argi], "--fingerprints") == 0)
+            opts.PrintFingerprints = true;
+        if (sscanf(argv[argi], "--near=%f,%f,%f", &opts.NearX, &opts.NearY, &opts.NearRadius) == 3)
+            opts.QueryNear = true;
+        if (sscanf(argv[argi], "--tiles=%d,%d,%d,%d", &opts.TileX0, &opts.TileY0, &opts.TileX1, &opts.TileY1) == 4)
+            opts.QueryTiles = true;
+        if (strncmp(argv[argi], "--where=", 8) == 0)
+        {
+            std::string error;
+            if (!opts.Where.Compile(argv[argi] + 8, error))
+            {
+                printf("Invalid --where expression: %s\n", error.c_str());
+                return -1;
+            }
+            opts.QueryWhere = true;
+        }
+        if (strcmp(argv[argi], "--histogram") == 0)
+            opts.Histogram = true;
+        if (strcmp(argv[argi], "--pack") == 0)
+            opts.Pack = true;
+        int snapshot, level = -1;
+        if (sscanf(argv[argi], "--snapshot=%d,%d", &snapshot, &level) >= 1 && snapshot >= 0)
+        {
+            opts.Snapshot = snapshot;
+            opts.SnapshotLevel = level;
+        }
+        if (strcmp(argv[argi], "--atlas") == 0)
+            opts.Atlas = true;
+        unsigned tile_size, tile_type, tile_color;
+        if (sscanf(argv[argi], "--tile-size=%u", &tile_size) == 1 &&
+            tile_size >= 1 && tile_size <= AtlasOptions::MaxTileSize)
+            opts.AtlasOpts.TileSize = tile_size;
+        if (sscanf(argv[argi], "--tile-color=%u,%x", &tile_type, &tile_color) == 2 &&
+            tile_type < AtlasOptions::TileColorCount)
+            opts.AtlasOpts.TileColors[tile_type] = tile_color & 0xFFFFFF;
+        int repack_level;
+        if (strcmp(argv[argi], "--repack") == 0)
+            opts.Repack = true;
+        if (sscanf(argv[argi], "--repack=%d", &repack_level) == 1 &&
+            repack_level >= UW2BlockEncoder::MinLevel && repack_level <= UW2BlockEncoder::MaxLevel)
+        {
+            opts.Repack = true;
+            opts.RepackLevel = repack_level;
+        }
+        if (strncmp(argv[argi], "--overlay=", 10) == 0)
+        {
+            opts.AtlasOpts.DrawDoors = false;
+            opts.AtlasOpts.DrawObjects = false;
+            // Comma-separated list of names
+            for (const char *name = argv[argi] + 10; name; )
+            {
+                const char *comma = strchr(name, ',');
+                const std::string overlay = comma ? std::string(name, comma) : std::string(name);
+                name = comma ? comma + 1 : nullptr;
+                if (overlay == "doors" || overlay == "all")
+                    opts.AtlasOpts.DrawDoors = true;
+                if (overlay == "objects" || overlay == "all")
+                    opts.AtlasOpts.DrawObjects = true;
+                if (overlay != "doors" && overlay != "objects" && overlay != "all" && overlay != "none")
+                {
+                    printf("Invalid --overlay name: %s\n", overlay.c_str());
+                    return -1;
+                }
+            }
+        }
     }
 
-    const char *in_filename = argv[argi++];
-    const char *out_filename = (argi < argc) ? argv[argi++] : nullptr;
+    // All the arguments but the last one are input files
+    std::vector<std::string> in_filenames;
+    for (; argi < argc - 1; ++argi)
+        in_filenames.push_back(argv[argi]);
+    const char *out_filename = (argi < argc && !in_filenames.empty()) ? argv[argi++] : nullptr;
 
     if (opts.PrintHelp || !out_filename)
     {
@@ -245,25 +729,174 @@ int main(int argc, char **argv)
         return 0;
     }
 
-    std::vector<LevelData> levels;
+    if (opts.Histogram)
+    {
+        Stream out(ChunkedWriteStream::TryOpen(out_filename));
+        if (!out)
+            return -1;
+        HistogramCounter counter;
+        size_t failed_num = 0;
+        ReadArchivesBatch(in_filenames, opts.Game,
+            [&counter, &failed_num](size_t /*index*/, const std::string& /*path*/, GameType /*game*/, bool ok,
+                                    const std::vector<SharedLevel> &levels)
+            {
+                if (!ok)
+                    failed_num++;
+                for (const auto &level : levels)
+                    counter.AddLevel(level);
+            });
+        ItemHistogram hist;
+        counter.GetResult(hist);
+        print_histogram(out, hist, in_filenames.size(), failed_num);
+        return 0;
+    }
+
+    if (opts.Atlas)
     {
-        Stream in(FileStream::TryOpen(in_filename, kFileMode_Open, kStream_Read));
-        if (in)
+        // Atlas width depends on the games of the inputs, which are
+        // detected by their headers first
+        uint16_t columns = GetAtlasColumns(opts.Game);
+        for (size_t i = 0; i < in_filenames.size() && opts.Game == kGameUnknown; ++i)
         {
-            if (opts.UW2)
-                ReadLevelsUW2(in, levels);
-            else
-                ReadLevelsUW1(in, levels);
+            Stream in(SharedFileStream::TryOpen(in_filenames[i]));
+            GameType game;
+            if (in && DetectGameType(in, game))
+                columns = std::max(columns, GetAtlasColumns(game));
+        }
+        if (columns == 0)
+        {
+            printf("Failed to detect the game of the input archives, use -uw1 or -uw2\n");
+            return -1;
+        }
+        Stream out(ChunkedWriteStream::TryOpen(out_filename));
+        if (!out)
+            return -1;
+        AtlasWriter atlas(out, opts.AtlasOpts, columns, in_filenames.size());
+        bool ok = atlas.Begin();
+        ReadArchivesBatch(in_filenames, opts.Game,
+            [&atlas, &ok](size_t /*index*/, const std::string& /*path*/, GameType /*game*/, bool /*ok*/,
+                          const std::vector<SharedLevel> &levels)
+            {
+                ok = atlas.AddRow(levels) && ok;
+            });
+        ok = atlas.Finish() && ok;
+        out.Flush(); // so that the write errors are known
+        ok = ok && out.IsValid();
+        if (!ok)
+        {
+            printf("Failed to write the atlas\n");
+            return -1;
+        }
+        return 0;
+    }
+
+    if (opts.Repack)
+    {
+        if (in_filenames.size() > 1)
+        {
+            printf("--repack takes one input archive\n");
+            return -1;
+        }
+        Stream in(SharedFileStream::TryOpen(in_filenames[0]));
+        GameType game = opts.Game;
+        if (!in || (game == kGameUnknown && !DetectGameType(in, game)))
+        {
+            printf("Failed to open the archive, or to detect its game\n");
+            return -1;
         }
+        std::vector<LevelData> levels;
+        ReadLevels(in, game, levels);
+        const std::vector<bool> modified(levels.size(), true);
+        Stream out(ChunkedWriteStream::TryOpen(out_filename));
+        if (!out)
+            return -1;
+        bool ok = WriteArchive(in, game, levels, modified, out, opts.RepackLevel);
+        out.Flush(); // so that the write errors are known
+        ok = ok && out.IsValid();
+        if (!ok)
+        {
+            printf("Failed to repack the archive\n");
+            return -1;
+        }
+        printf("Repacked %d levels, %lld bytes into %lld bytes\n", static_cast<int>(levels.size()),
+            static_cast<long long>(in.GetLength()), static_cast<long long>(out.GetLength()));
+        return 0;
     }
 
-    if (out_filename)
+    if (opts.Pack)
     {
         Stream out(FileStream::TryOpen(out_filename, kFileMode_CreateAlways, kStream_Write));
-        if (out)
+        if (!out)
+            return -1;
+        HistoryPackWriter pack(out, opts.Game);
+        for (const auto &path : in_filenames)
+        {
+            Stream in(SharedFileStream::TryOpen(path));
+            if (!pack.AddSnapshot(in, path))
+            {
+                printf("Failed to pack %s\n", path.c_str());
+                return -1;
+            }
+        }
+        if (!pack.Finish())
         {
-            print_levels(out, levels, opts);
+            printf("Failed to write the pack\n");
+            return -1;
         }
+        printf("Packed %d archives, %lld bytes into %lld bytes\n", static_cast<int>(in_filenames.size()),
+            static_cast<long long>(pack.GetSourceSize()), static_cast<long long>(out.GetLength()));
+        return 0;
+    }
+
+    if (in_filenames.size() > 1)
+    {
+        // Batch mode: read many archives at once, print each in turn
+        Stream out(ChunkedWriteStream::TryOpen(out_filename));
+        if (!out)
+            return -1;
+        ReadArchivesBatch(in_filenames, opts.Game,
+            [&out, &opts](size_t /*index*/, const std::string &path, GameType game, bool ok,
+                          const std::vector<SharedLevel> &levels)
+            {
+                write_text_ln(out, "##########################################");
+                write_text_ln(out, StrPrint(" Archive: %s", path.c_str()));
+                if (!ok)
+                    write_text_ln(out, " Failed to open the archive, or to detect its game");
+                // Other blocks are read here, only if these are requested
+                Stream in(ok && opts.NeedsArchive() ? SharedFileStream::TryOpen(path) : nullptr);
+                std::unique_ptr<LevelArchive> archive(in ? new LevelArchive(in, game) : nullptr);
+                if (archive && opts.PrintFingerprints)
+                    print_fingerprints(out, *archive);
+                print_levels(out, levels, opts, archive.get());
+            });
+        return 0;
+    }
+
+    // Single archive: print levels as soon as they are read
+    Stream out(ChunkedWriteStream::TryOpen(out_filename));
+    if (!out)
+        return 0;
+    std::unique_ptr<SharedFileStream> in_file = SharedFileStream::TryOpen(in_filenames[0]);
+    const std::shared_ptr<SharedFile> file = in_file ? in_file->GetFile() : nullptr;
+    Stream in(std::move(in_file));
+    if (!in)
+        return 0;
+    if (opts.Snapshot >= 0)
+    {
+        print_snapshot(out, in, opts);
+        return 0;
+    }
+    GameType game = opts.Game;
+    if (game == kGameUnknown && !DetectGameType(in, game))
+    {
+        write_text_ln(out, "Failed to detect the game of the archive, use -uw1 or -uw2");
+        return 0;
     }
+    std::unique_ptr<LevelArchive> archive(opts.NeedsArchive() ? new LevelArchive(in, game) : nullptr);
+    if (archive && opts.PrintFingerprints)
+        print_fingerprints(out, *archive);
+    // Levels are read and decoded on other threads, while the previous ones are printed
+    ForEachLevelPipelined(file, game,
+        [&out, &opts, &archive](const LevelData &level) { print_level(out, level, opts, archive.get()); });
     return 0;
 }
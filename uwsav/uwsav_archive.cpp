@@ -0,0 +1,186 @@
+#include "uwsav_archive.h"
+#include <algorithm>
+#include "uwsav_compress.h"
+#include "utils/binaryreader.h"
+
+size_t AutomapData::CountSeen() const
+{
+    return Tiles.size() - std::count(Tiles.begin(), Tiles.end(), 0);
+}
+
+LevelArchive::LevelArchive(Stream &in, GameType game)
+    : _in(in)
+    , _game(game)
+{
+    ReadArchiveDirectory(in, game, _blocks);
+}
+
+const ArchiveBlockInfo *LevelArchive::FindBlock(BlockKind kind, uint8_t world_id, uint8_t level_id) const
+{
+    for (const auto &block : _blocks)
+    {
+        if (block.Kind == kind && block.WorldID == world_id && block.LevelID == level_id)
+            return &block;
+    }
+    return nullptr;
+}
+
+bool LevelArchive::ReadFingerprints()
+{
+    bool ok = true;
+    for (auto &block : _blocks)
+    {
+        if (block.Kind != kBlockUnused)
+            ok &= ReadBlockFingerprint(_in, block.Block, block.Fingerprint);
+    }
+    return ok;
+}
+
+// Reads raw block data from the stream
+static void ReadRawBlock(Stream &in, const DataBlockInfo &block, std::vector<uint8_t> &data)
+{
+    in.Seek(block.Offset, kSeekBegin);
+    data.resize(block.Size);
+    data.resize(in.Read(data.data(), block.Size));
+}
+
+bool LevelArchive::ReadBlockData(const ArchiveBlockInfo &block, BlockKind kind)
+{
+    if (block.Kind != kind)
+        return false;
+    if (block.Block.IsCompressed)
+    {
+        ReadRawBlock(_in, block.Block, _compressed);
+        _data.clear();
+        return UncompressUW2Block(_compressed.data(), _compressed.size(), _data);
+    }
+    ReadRawBlock(_in, block.Block, _data);
+    return true;
+}
+
+bool LevelArchive::ReadLevel(const ArchiveBlockInfo &block, LevelData &level)
+{
+    if (block.Kind != kBlockLevel)
+        return false;
+    ReadRawBlock(_in, block.Block, _compressed);
+    level.LevelID = block.LevelID;
+    level.WorldID = block.WorldID;
+    DecodeLevelBlock(_compressed.data(), _compressed.size(), block.Block, level);
+    return true;
+}
+
+// Texture mapping
+/*
+    UW1 (0x7a bytes):
+    0000   Int16[48]  wall textures
+    0060   Int16[10]  floor textures
+    0074   Int8[6]    door textures
+
+    UW2 (0x86 bytes):
+    0000   Int16[64]  textures, shared by walls and floors
+    0080   Int8[6]    door textures
+*/
+bool LevelArchive::ReadTextureMapping(const ArchiveBlockInfo &block, TextureMapping &texmap)
+{
+    if (!ReadBlockData(block, kBlockTextureMap))
+        return false;
+    const size_t wall_num = (_game == kGameUW2) ? 64u : 48u;
+    const size_t floor_num = (_game == kGameUW2) ? 0u : 10u;
+    const size_t door_num = 6u;
+    BinaryReader in(_data.data(), _data.size());
+    if (!in.Require((wall_num + floor_num) * sizeof(int16_t) + door_num))
+        return false;
+    texmap.Walls.resize(wall_num);
+    in.ReadArrayInt16LE(reinterpret_cast<int16_t*>(texmap.Walls.data()), wall_num);
+    if (floor_num > 0)
+    {
+        texmap.Floors.resize(floor_num);
+        in.ReadArrayInt16LE(reinterpret_cast<int16_t*>(texmap.Floors.data()), floor_num);
+    }
+    else
+    {
+        texmap.Floors = texmap.Walls;
+    }
+    texmap.Doors.resize(door_num);
+    in.Read(texmap.Doors.data(), door_num);
+    return true;
+}
+
+// Automap info
+/*
+    0x1000 bytes, one for each tile of the 64x64 map, in the same order as
+    the tilemap.
+
+        0- 3    tile type, as displayed on the automap
+        4- 7    flags, not well researched
+
+    Tiles that the player has not seen yet are zero.
+*/
+bool LevelArchive::ReadAutomap(const ArchiveBlockInfo &block, AutomapData &automap)
+{
+    if (!ReadBlockData(block, kBlockAutomap))
+        return false;
+    automap.Tiles.assign(LevelData::Width * LevelData::Height, 0u);
+    std::copy_n(_data.begin(), std::min(_data.size(), automap.Tiles.size()), automap.Tiles.begin());
+    return true;
+}
+
+// Map notes
+/*
+    A list of 54-byte records, as many as fit in the block:
+
+    0000   Int8[50]   note text, null-terminated
+    0032   Int16      x position on the map, in pixels
+    0034   Int16      y position on the map, in pixels
+*/
+bool LevelArchive::ReadMapNotes(const ArchiveBlockInfo &block, std::vector<MapNote> &notes)
+{
+    notes.clear();
+    if (!ReadBlockData(block, kBlockMapNotes))
+        return false;
+    const size_t text_size = 50u;
+    const size_t note_size = text_size + sizeof(int16_t) * 2;
+    BinaryReader in(_data.data(), _data.size());
+    while (in.Require(note_size))
+    {
+        MapNote note;
+        const char *text = reinterpret_cast<const char*>(in.ReadBytes(text_size));
+        note.Text.assign(text, std::find(text, text + text_size, '\0'));
+        note.X = in.ReadInt16LE();
+        note.Y = in.ReadInt16LE();
+        notes.push_back(note);
+    }
+    return true;
+}
+
+// Object animation overlays (UW1)
+/*
+    0x180 bytes, 64 entries of 6 bytes each:
+
+    0000   Int16      0- 5  unknown
+                      6-15  index of the animated object
+    0002   Int16      animation time left; 0xFFFF means endless
+    0004   Int8       tile x
+    0005   Int8       tile y
+
+    Entries with zero object index are unused.
+*/
+bool LevelArchive::ReadAnimOverlays(const ArchiveBlockInfo &block, std::vector<AnimOverlay> &overlays)
+{
+    overlays.clear();
+    if (!ReadBlockData(block, kBlockAnimOverlay))
+        return false;
+    const size_t entry_size = 6u;
+    BinaryReader in(_data.data(), _data.size());
+    while (in.Require(entry_size))
+    {
+        AnimOverlay overlay;
+        overlay.ObjIndex = static_cast<uint16_t>(in.ReadInt16LE()) >> 6;
+        overlay.Duration = static_cast<uint16_t>(in.ReadInt16LE());
+        overlay.TileX = static_cast<uint8_t>(in.ReadInt8());
+        overlay.TileY = static_cast<uint8_t>(in.ReadInt8());
+        if (overlay.ObjIndex != 0)
+            overlays.push_back(overlay);
+    }
+    return true;
+}
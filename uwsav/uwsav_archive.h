@@ -0,0 +1,91 @@
+//=============================================================================
+//
+// LEVEL.ARK archive with typed access to all of its known block kinds.
+//
+// Only the archive directory is read on construction; each block is read
+// and decoded when requested, so the block kinds that are not used are
+// never read.
+//
+//=============================================================================
+#ifndef UWSAV__ARCHIVE_H__
+#define UWSAV__ARCHIVE_H__
+
+#include <string>
+#include <vector>
+#include "uwsav/uwsav_data.h"
+
+// Texture mapping of a level: translates texture indexes used by tiles
+// into the game's texture numbers
+struct TextureMapping
+{
+    std::vector<uint16_t> Walls;
+    std::vector<uint16_t> Floors;
+    std::vector<uint8_t>  Doors;
+};
+
+// Automap info of a level: one byte per tile
+struct AutomapData
+{
+    std::vector<uint8_t> Tiles;
+
+    // Returns automap tile type, as it is displayed on the map
+    uint8_t GetTileType(uint16_t x, uint16_t y) const { return Tiles[y * LevelData::Width + x] & 0x0F; }
+    // Tells if the tile was seen by the player
+    bool IsSeen(uint16_t x, uint16_t y) const { return Tiles[y * LevelData::Width + x] != 0; }
+    // Returns number of tiles seen by the player
+    size_t CountSeen() const;
+};
+
+// A note put on the automap by the player
+struct MapNote
+{
+    std::string Text;
+    int16_t X = 0; // position on the map, in pixels
+    int16_t Y = 0;
+};
+
+// Object animation overlay (UW1)
+struct AnimOverlay
+{
+    uint16_t ObjIndex = 0u; // animated object
+    uint16_t Duration = 0u; // animation time left; 0xFFFF is endless
+    uint8_t  TileX = 0u;
+    uint8_t  TileY = 0u;
+};
+
+class LevelArchive
+{
+public:
+    // Reads the archive directory; the stream must persist while the
+    // archive is used
+    LevelArchive(Stream &in, GameType game);
+
+    GameType GetGame() const { return _game; }
+    const std::vector<ArchiveBlockInfo> &GetBlocks() const { return _blocks; }
+    // Finds the block of the given kind for the level; returns null if there's none
+    const ArchiveBlockInfo *FindBlock(BlockKind kind, uint8_t world_id, uint8_t level_id) const;
+
+    // Computes fingerprints of all used blocks, and stores them in the
+    // directory; returns false if any of the blocks could not be read
+    bool ReadFingerprints();
+
+    // Following read the block of a corresponding kind;
+    // return false if the block is of a different kind or could not be read
+    bool ReadLevel(const ArchiveBlockInfo &block, LevelData &level);
+    bool ReadTextureMapping(const ArchiveBlockInfo &block, TextureMapping &texmap);
+    bool ReadAutomap(const ArchiveBlockInfo &block, AutomapData &automap);
+    bool ReadMapNotes(const ArchiveBlockInfo &block, std::vector<MapNote> &notes);
+    bool ReadAnimOverlays(const ArchiveBlockInfo &block, std::vector<AnimOverlay> &overlays);
+
+private:
+    // Reads block data, decompressing it if necessary
+    bool ReadBlockData(const ArchiveBlockInfo &block, BlockKind kind);
+
+    Stream &_in;
+    const GameType _game;
+    std::vector<ArchiveBlockInfo> _blocks;
+    std::vector<uint8_t> _data; // last read block data
+    std::vector<uint8_t> _compressed;
+};
+
+#endif // UWSAV__ARCHIVE_H__
@@ -0,0 +1,224 @@
+#include "uwsav_atlas.h"
+#include <stdio.h>
+#include <string.h>
+
+// Number of levels in the UW1 archives
+static const uint16_t UW1LevelCount = 9u;
+// UW2 level grid
+static const uint16_t UW2WorldCount = 10u;
+static const uint16_t UW2LevelsPerWorld = 8u;
+
+// Floor heights are 4 bits
+static const size_t FloorHeightCount = 16u;
+// Colour of the tile type which is not known
+static const size_t UnknownTileColor = AtlasOptions::TileColorCount - 1;
+
+static const uint32_t BlankColor = 0x000000;
+static const uint32_t DoorColor = 0xC06020;
+static const uint32_t ObjectTintColor = 0xFF2020;
+// Tint strength by the number of objects on the tile, out of 256
+static const uint8_t ObjectTint[] = { 0, 72, 104, 132, 156, 176, 192, 208 };
+static const size_t ObjectTintCount = sizeof(ObjectTint) / sizeof(ObjectTint[0]);
+
+AtlasOptions::AtlasOptions()
+{
+    TileColors[kTileSolid]  = 0x282828;
+    TileColors[kTileOpen]   = 0xB4AC96;
+    TileColors[kTileOpenSE] = 0xB4AC96;
+    TileColors[kTileOpenSW] = 0xB4AC96;
+    TileColors[kTileOpenNE] = 0xB4AC96;
+    TileColors[kTileOpenNW] = 0xB4AC96;
+    TileColors[kTileSlopeN] = 0x8CA0B4;
+    TileColors[kTileSlopeS] = 0x8CA0B4;
+    TileColors[kTileSlopeE] = 0x8CA0B4;
+    TileColors[kTileSlopeW] = 0x8CA0B4;
+    TileColors[UnknownTileColor] = 0xFF00FF;
+}
+
+uint16_t GetAtlasColumns(GameType game)
+{
+    switch (game)
+    {
+    case kGameUW1: return UW1LevelCount;
+    case kGameUW2: return UW2WorldCount * UW2LevelsPerWorld;
+    default: return 0u;
+    }
+}
+
+uint16_t GetAtlasCell(const LevelData &level)
+{
+    // Ids count from 1; UW1 levels have no world
+    if (level.WorldID > 0)
+        return static_cast<uint16_t>((level.WorldID - 1) * UW2LevelsPerWorld + level.LevelID - 1);
+    return static_cast<uint16_t>(level.LevelID - 1);
+}
+
+static void SetColor(uint8_t *rgb, uint32_t color)
+{
+    rgb[0] = static_cast<uint8_t>(color >> 16);
+    rgb[1] = static_cast<uint8_t>(color >> 8);
+    rgb[2] = static_cast<uint8_t>(color);
+}
+
+// Tells if the pixel lies in the open part of the tile; y goes down the
+// image, which is to the south
+static bool IsOpenPixel(size_t color, size_t x, size_t y, size_t size)
+{
+    switch (color)
+    {
+    case kTileSolid:  return false;
+    case kTileOpenSE: return x + y >= size - 1;
+    case kTileOpenSW: return y >= x;
+    case kTileOpenNE: return y <= x;
+    case kTileOpenNW: return x + y <= size - 1;
+    default:          return true;
+    }
+}
+
+AtlasWriter::AtlasWriter(Stream &out, const AtlasOptions &opts, uint16_t columns, size_t rows,
+                         unsigned thread_count)
+    : _out(out)
+    , _opts(opts)
+    , _columns(columns)
+    , _rows(rows)
+    , _cellSize(LevelData::Width * static_cast<size_t>(opts.TileSize))
+    , _stride(_cellSize * columns * 3u)
+    , _pool(thread_count)
+{
+    const size_t ts = opts.TileSize;
+    const size_t color_count = AtlasOptions::TileColorCount;
+    _masks.resize(2u * color_count * ts * ts);
+    for (size_t color = 0; color < color_count; ++color)
+    {
+        uint8_t *mask = &_masks[color * ts * ts];
+        uint8_t *door_mask = &_masks[(color_count + color) * ts * ts];
+        // Door mark is the middle half of the tile, at least one pixel
+        const size_t door_from = ts / 4u, door_to = std::max(ts - ts / 4u, door_from + 1u);
+        for (size_t y = 0; y < ts; ++y)
+        {
+            for (size_t x = 0; x < ts; ++x)
+            {
+                const size_t i = y * ts + x;
+                mask[i] = IsOpenPixel(color, x, y, ts) ? 1u : 0u;
+                const bool is_door = x >= door_from && x < door_to && y >= door_from && y < door_to;
+                door_mask[i] = is_door ? 2u : mask[i];
+            }
+        }
+    }
+
+    // Higher floors are lighter
+    _openColors.resize(color_count * FloorHeightCount * 3u);
+    for (size_t color = 0; color < color_count; ++color)
+    {
+        uint8_t base[3];
+        SetColor(base, opts.TileColors[color]);
+        for (size_t height = 0; height < FloorHeightCount; ++height)
+        {
+            const unsigned shade = 160u + static_cast<unsigned>(height) * 6u;
+            uint8_t *rgb = &_openColors[(color * FloorHeightCount + height) * 3u];
+            for (size_t c = 0; c < 3; ++c)
+                rgb[c] = static_cast<uint8_t>(std::min(255u, base[c] * shade / 240u));
+        }
+    }
+
+    _row.resize(_stride * _cellSize);
+}
+
+bool AtlasWriter::Begin()
+{
+    char header[64];
+    const int len = snprintf(header, sizeof(header), "P6\n%u %u\n255\n",
+        static_cast<unsigned>(_cellSize * _columns), static_cast<unsigned>(_cellSize * _rows));
+    return _out.Write(header, len) == static_cast<size_t>(len);
+}
+
+bool AtlasWriter::AddRow(const std::vector<SharedLevel> &levels)
+{
+    if (_rowsWritten >= _rows)
+        return false;
+    uint8_t blank[3];
+    SetColor(blank, BlankColor);
+    for (size_t i = 0; i < _row.size(); i += 3)
+        memcpy(&_row[i], blank, 3);
+
+    // Each level draws into its own cell, so they need no locking; the
+    // level is kept alive by the task until it's drawn
+    std::vector<bool> used(_columns);
+    for (const auto &level : levels)
+    {
+        const uint16_t cell = GetAtlasCell(*level);
+        if (cell >= _columns || used[cell])
+            continue;
+        used[cell] = true;
+        uint8_t *dst = &_row[cell * _cellSize * 3u];
+        _pool.Post([this, level, dst]() { DrawLevel(*level, dst); });
+    }
+    _pool.Wait();
+    _rowsWritten++;
+    return _out.Write(_row.data(), _row.size()) == _row.size();
+}
+
+bool AtlasWriter::Finish()
+{
+    const std::vector<SharedLevel> none;
+    bool ok = true;
+    while (ok && _rowsWritten < _rows)
+        ok = AddRow(none);
+    return ok;
+}
+
+void AtlasWriter::DrawLevel(const LevelData &level, uint8_t *dst) const
+{
+    const size_t ts = _opts.TileSize;
+    const size_t tile_num = std::min<size_t>(level.tiles.size(), LevelData::Width * LevelData::Height);
+
+    // Count objects lying on each tile; each object is counted only once,
+    // which also protects from the looped chains in the broken data
+    std::vector<uint8_t> obj_count(tile_num);
+    if (_opts.DrawObjects)
+    {
+        std::vector<bool> visited(level.objs.size());
+        for (size_t tile = 0; tile < tile_num; ++tile)
+        {
+            for (uint16_t obj_index = level.tiles[tile].FirstObjLink;
+                 obj_index > 0 && obj_index < level.objs.size() && !visited[obj_index];
+                 obj_index = level.objs[obj_index].NextObjLink)
+            {
+                visited[obj_index] = true;
+                if (obj_count[tile] < ObjectTintCount - 1)
+                    obj_count[tile]++;
+            }
+        }
+    }
+
+    uint8_t tint[3];
+    SetColor(tint, ObjectTintColor);
+    // Colours of the tile pixels, indexed by the mask values
+    uint8_t colors[3][3];
+    SetColor(colors[0], _opts.TileColors[kTileSolid]);
+    SetColor(colors[2], DoorColor);
+    for (size_t tile = 0; tile < tile_num; ++tile)
+    {
+        const TileData &tile_data = level.tiles[tile];
+        const size_t color = (tile_data.Type >= kTileSolid && tile_data.Type <= kTileSlopeW) ?
+            static_cast<size_t>(tile_data.Type) : UnknownTileColor;
+        const size_t height = tile_data.FloorHeight % FloorHeightCount;
+        memcpy(colors[1], &_openColors[(color * FloorHeightCount + height) * 3u], 3);
+        const unsigned strength = ObjectTint[obj_count[tile]];
+        for (size_t c = 0; c < 3 && strength > 0; ++c)
+            colors[1][c] = static_cast<uint8_t>(colors[1][c] + ((tint[c] - colors[1][c]) * static_cast<int>(strength)) / 256);
+        const bool is_door = _opts.DrawDoors && tile_data.IsDoor;
+        const uint8_t *mask = &_masks[((is_door ? AtlasOptions::TileColorCount : 0u) + color) * ts * ts];
+
+        // y axis is inverse, north goes up
+        const size_t x = tile % LevelData::Width;
+        const size_t y = LevelData::Height - 1u - tile / LevelData::Width;
+        uint8_t *line = dst + y * ts * _stride + x * ts * 3u;
+        for (size_t py = 0; py < ts; ++py, line += _stride, mask += ts)
+        {
+            uint8_t *px = line;
+            for (size_t px_x = 0; px_x < ts; ++px_x, px += 3)
+                memcpy(px, colors[mask[px_x]], 3);
+        }
+    }
+}
@@ -0,0 +1,83 @@
+//=============================================================================
+//
+// Image atlas of the level maps.
+//
+// The atlas is a binary PPM (P6) image, where each input archive makes one
+// row of level maps, and each level has a fixed cell in its row, so that
+// the same level of different saves lines up in a column. The image size
+// is known in advance, so the rows are written one by one, as soon as the
+// archives are read, and only one row is kept in memory.
+//
+// Tiles are drawn with lookup tables: a pixel mask per tile type, which
+// tells the open part of the tile from the solid one, and the colours of
+// the open part per tile type and floor height. Doors are drawn as a mark
+// in the middle of the tile, and tiles with objects lying on them are
+// tinted, the more objects the stronger. Levels of a row are drawn in
+// parallel, each into its own cell.
+//
+//=============================================================================
+#ifndef UWSAV__ATLAS_H__
+#define UWSAV__ATLAS_H__
+
+#include <vector>
+#include "uwsav/uwsav_data.h"
+#include "uwsav/uwsav_levelcache.h"
+#include "utils/threadpool.h"
+
+struct AtlasOptions
+{
+    static const unsigned MaxTileSize = 16u;
+    // Number of tile colours: a colour per TileType, and one for the
+    // unknown types found in broken data
+    static const size_t TileColorCount = kTileSlopeW + 2;
+
+    unsigned TileSize = 4u; // tile side, in pixels
+    bool DrawDoors = true;
+    bool DrawObjects = true; // tint tiles by the number of objects on them
+    uint32_t TileColors[TileColorCount]; // 0xRRGGBB
+
+    AtlasOptions();
+};
+
+// Returns number of level cells in a row for the game's archives
+uint16_t GetAtlasColumns(GameType game);
+// Returns index of the level's cell in its row
+uint16_t GetAtlasCell(const LevelData &level);
+
+class AtlasWriter
+{
+public:
+    // Prepares writing of the atlas with the given number of cells per row,
+    // and the number of rows; 0 threads means the number of hardware threads
+    AtlasWriter(Stream &out, const AtlasOptions &opts, uint16_t columns, size_t rows,
+                unsigned thread_count = 0u);
+
+    // Writes the image header
+    bool    Begin();
+    // Draws the levels of one archive, and writes them as the next row;
+    // cells of the missing levels are left blank
+    bool    AddRow(const std::vector<SharedLevel> &levels);
+    // Writes blank rows in place of those which were not added
+    bool    Finish();
+
+private:
+    // Draws the level into the cell, which starts at dst
+    void    DrawLevel(const LevelData &level, uint8_t *dst) const;
+
+    Stream &_out;
+    const AtlasOptions _opts;
+    const uint16_t _columns;
+    const size_t _rows;
+    const size_t _cellSize; // cell side, in pixels
+    const size_t _stride; // row of pixels, in bytes
+    size_t _rowsWritten = 0u;
+    // Lookup tables: pixel masks, per tile colour, without and with a door: tile side
+    // squared values, 0 is solid, 1 is open, 2 is door
+    std::vector<uint8_t> _masks;
+    std::vector<uint8_t> _openColors; // per tile colour and floor height: RGB
+    // Pixels of the current row
+    std::vector<uint8_t> _row;
+    ThreadPool _pool;
+};
+
+#endif // UWSAV__ATLAS_H__
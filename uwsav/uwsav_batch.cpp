@@ -0,0 +1,316 @@
+#include "uwsav_batch.h"
+#include <algorithm>
+#include <condition_variable>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include "utils/asyncfilereader.h"
+#include "utils/memoryarena.h"
+#include "utils/sharedfilestream.h"
+#include "utils/spscqueue.h"
+#include "utils/threadpool.h"
+
+// Number of archives being read simultaneously; limits the number of open
+// files, and the amount of memory held by the read data
+static const size_t MaxArchivesInFlight = 64u;
+// Size of the first read of the archive header, which is enough for the
+// headers of known games; larger headers are completed separately
+static const size_t HeaderReadSize = 8192u;
+// Number of read archives which may wait for the callback
+static const size_t ReportQueueSize = 8u;
+
+// Level block data read into memory
+struct BlockBuffer
+{
+    uint8_t *Data = nullptr;
+    size_t   Size = 0u;
+};
+
+// State of a single archive being read
+struct ArchiveJob
+{
+    size_t      Index = 0u;
+    std::string Path;
+    GameType    Game = kGameUnknown;
+    std::shared_ptr<SharedFile> File;
+    // Holds the block data; all of it is allocated on the I/O thread,
+    // before the blocks are passed to the workers
+    std::unique_ptr<MemoryArena> Arena;
+    std::vector<uint8_t> Header;
+    std::vector<LevelBlockInfo> LevelBlocks;
+    std::vector<BlockBuffer> BlockData;
+    std::vector<SharedLevel> Levels;
+    bool        Ok = true;
+    // Following are guarded by the batch mutex
+    size_t      PendingBlocks = 0u;
+    bool        Done = false;
+};
+
+// Archive read completely, waiting to be reported
+struct ArchiveResult
+{
+    size_t      Index = 0u;
+    std::string Path;
+    GameType    Game = kGameUnknown;
+    bool        Ok = false;
+    std::vector<SharedLevel> Levels;
+};
+
+// Reads archives one by one, with regular file streams
+static void ReadArchivesSequential(const std::vector<std::string> &paths, GameType game,
+                                   const ArchiveCallback &on_archive, LevelCache &cache)
+{
+    std::vector<uint8_t> data;
+    for (size_t i = 0; i < paths.size(); ++i)
+    {
+        std::vector<SharedLevel> levels;
+        GameType arc_game = game;
+        Stream in(SharedFileStream::TryOpen(paths[i]));
+        const bool ok = in && (arc_game != kGameUnknown || DetectGameType(in, arc_game));
+        if (ok)
+        {
+            std::vector<LevelBlockInfo> level_blocks;
+            ReadLevelDirectory(in, arc_game, level_blocks);
+            for (const auto &level_block : level_blocks)
+            {
+                in.Seek(level_block.Block.Offset, kSeekBegin);
+                data.resize(level_block.Block.Size);
+                data.resize(in.Read(data.data(), data.size()));
+                levels.push_back(cache.GetOrDecode(level_block, data.data(), data.size()));
+            }
+        }
+        on_archive(i, paths[i], arc_game, ok, levels);
+    }
+}
+
+// Asynchronous batch reader: the I/O is driven by the calling thread,
+// and the level blocks are decoded by the worker threads.
+class BatchReader
+{
+public:
+    BatchReader(AsyncFileReader &reader, GameType game, LevelCache &cache)
+        : _reader(reader), _game(game), _cache(cache) {}
+
+    void Run(const std::vector<std::string> &paths, const ArchiveCallback &on_archive)
+    {
+        size_t next_open = 0u;
+        while (next_open < paths.size() || !_jobs.empty())
+        {
+            // Start reading more archives, up to the limit
+            while (next_open < paths.size() && _jobs.size() < MaxArchivesInFlight)
+            {
+                StartArchive(next_open, paths[next_open]);
+                next_open++;
+            }
+
+            // Report complete archives, in the input order
+            ArchiveJob &job = *_jobs.front();
+            if (IsDone(job))
+            {
+                on_archive(job.Index, job.Path, job.Game, job.Ok, job.Levels);
+                ReleaseArchive(std::move(_jobs.front()));
+                _jobs.pop_front();
+                continue;
+            }
+
+            // Wait for more progress: either read completion or decoded blocks
+            if (_reader.HasPending())
+            {
+                _reader.Poll();
+            }
+            else
+            {
+                std::unique_lock<std::mutex> lk(_mutex);
+                _doneCond.wait(lk, [&job] { return job.Done; });
+            }
+        }
+    }
+
+private:
+    bool IsDone(ArchiveJob &job)
+    {
+        std::lock_guard<std::mutex> lk(_mutex);
+        return job.Done;
+    }
+
+    void SetDone(ArchiveJob &job)
+    {
+        {
+            std::lock_guard<std::mutex> lk(_mutex);
+            job.Done = true;
+        }
+        _doneCond.notify_all();
+    }
+
+    void StartArchive(size_t index, const std::string &path)
+    {
+        std::unique_ptr<ArchiveJob> job(new ArchiveJob());
+        job->Index = index;
+        job->Path = path;
+        job->Game = _game;
+        if (_freeArenas.empty())
+        {
+            job->Arena.reset(new MemoryArena());
+        }
+        else
+        {
+            job->Arena = std::move(_freeArenas.back());
+            _freeArenas.pop_back();
+        }
+        job->File = SharedFile::TryOpen(path);
+        ArchiveJob *pjob = job.get();
+        _jobs.push_back(std::move(job));
+        if (!pjob->File)
+        {
+            pjob->Ok = false;
+            SetDone(*pjob);
+            return;
+        }
+
+        pjob->Header.resize(static_cast<size_t>(
+            std::min<soff_t>(HeaderReadSize, pjob->File->GetLength())));
+        _reader.Queue(*pjob->File, 0, pjob->Header.data(), pjob->Header.size(),
+            [this, pjob](size_t was_read) { OnHeaderRead(*pjob, was_read); });
+    }
+
+    void OnHeaderRead(ArchiveJob &job, size_t was_read)
+    {
+        job.Header.resize(was_read);
+        if (was_read < sizeof(uint16_t))
+        {
+            job.Ok = false;
+            SetDone(job);
+            return;
+        }
+        // Complete the header if it did not fit in the first read
+        const uint16_t num_blocks = job.Header[0] | (job.Header[1] << 8);
+        const size_t header_size = GetArchiveHeaderSize(job.Game, num_blocks);
+        if (header_size > was_read)
+        {
+            job.Header.resize(header_size);
+            job.Header.resize(was_read + job.File->ReadAt(&job.Header[was_read],
+                header_size - was_read, was_read));
+        }
+        if (job.Game == kGameUnknown &&
+            !DetectGameType(job.Header.data(), job.Header.size(), job.File->GetLength(), job.Game))
+        {
+            job.Ok = false;
+            SetDone(job);
+            return;
+        }
+
+        ReadLevelDirectory(job.Header.data(), job.Header.size(), job.File->GetLength(),
+                           job.Game, job.LevelBlocks);
+        job.Header = std::vector<uint8_t>();
+
+        const size_t num_levels = job.LevelBlocks.size();
+        if (num_levels == 0)
+        {
+            SetDone(job);
+            return;
+        }
+
+        job.BlockData.resize(num_levels);
+        job.Levels.resize(num_levels);
+        {
+            std::lock_guard<std::mutex> lk(_mutex);
+            job.PendingBlocks = num_levels;
+        }
+        ArchiveJob *pjob = &job;
+        for (size_t i = 0; i < num_levels; ++i)
+        {
+            const DataBlockInfo &block = job.LevelBlocks[i].Block;
+            job.BlockData[i].Data = static_cast<uint8_t*>(job.Arena->Allocate(block.Size, 1u));
+            job.BlockData[i].Size = block.Size;
+            _reader.Queue(*job.File, block.Offset, job.BlockData[i].Data, block.Size,
+                [this, pjob, i](size_t was_read) { OnBlockRead(*pjob, i, was_read); });
+        }
+    }
+
+    void OnBlockRead(ArchiveJob &job, size_t block_index, size_t was_read)
+    {
+        job.BlockData[block_index].Size = was_read;
+        ArchiveJob *pjob = &job;
+        _workers.Post([this, pjob, block_index]() { DecodeBlock(*pjob, block_index); });
+    }
+
+    // Runs on a worker thread; levels identical to ones already in use
+    // are taken from the cache instead
+    void DecodeBlock(ArchiveJob &job, size_t block_index)
+    {
+        const BlockBuffer &data = job.BlockData[block_index];
+        job.Levels[block_index] = _cache.GetOrDecode(job.LevelBlocks[block_index], data.Data, data.Size);
+
+        bool done;
+        {
+            std::lock_guard<std::mutex> lk(_mutex);
+            done = (--job.PendingBlocks == 0);
+            job.Done = done;
+        }
+        if (done)
+            _doneCond.notify_all();
+    }
+
+    // Releases the reported archive, and keeps its arena for the next ones
+    void ReleaseArchive(std::unique_ptr<ArchiveJob> job)
+    {
+        std::unique_ptr<MemoryArena> arena = std::move(job->Arena);
+        job.reset(); // block data must be gone before the arena is reset
+        arena->Reset();
+        _freeArenas.push_back(std::move(arena));
+    }
+
+    AsyncFileReader &_reader;
+    const GameType _game;
+    LevelCache &_cache;
+    std::deque<std::unique_ptr<ArchiveJob>> _jobs; // archives in progress, in input order
+    std::vector<std::unique_ptr<MemoryArena>> _freeArenas; // arenas ready for reuse
+    std::mutex _mutex;
+    std::condition_variable _doneCond;
+    // Declared last, so that the workers are stopped first
+    ThreadPool _workers;
+};
+
+void ReadArchivesBatch(const std::vector<std::string> &paths, GameType game,
+                       const ArchiveCallback &on_archive, LevelCache *cache)
+{
+    LevelCache batch_cache;
+    if (!cache)
+        cache = &batch_cache;
+
+    // Archives are read on a separate thread, and reported on the calling
+    // one, so that reading the next archives goes on while the callback
+    // handles the previous ones; the reading stops when the queue is full
+    SpscQueue<ArchiveResult> done_queue(ReportQueueSize);
+    std::thread read_thread([&paths, game, cache, &done_queue]()
+    {
+        const ArchiveCallback on_read = [&done_queue](size_t index, const std::string &path, GameType arc_game,
+                                                      bool ok, const std::vector<SharedLevel> &levels)
+        {
+            ArchiveResult result;
+            result.Index = index;
+            result.Path = path;
+            result.Game = arc_game;
+            result.Ok = ok;
+            result.Levels = levels;
+            done_queue.Push(std::move(result));
+        };
+        auto reader = AsyncFileReader::Create();
+        if (reader)
+        {
+            BatchReader batch(*reader, game, *cache);
+            batch.Run(paths, on_read);
+        }
+        else
+        {
+            ReadArchivesSequential(paths, game, on_read, *cache);
+        }
+        done_queue.Close();
+    });
+
+    ArchiveResult result;
+    while (done_queue.Pop(result))
+        on_archive(result.Index, result.Path, result.Game, result.Ok, result.Levels);
+    read_thread.join();
+}
@@ -0,0 +1,38 @@
+//=============================================================================
+//
+// Batch reading of many LEVEL.ARK files.
+//
+// Where supported, the archives are read with asynchronous I/O: headers of
+// many archives are requested at once, then the level blocks found in each
+// header, and completed blocks are decoded on a pool of worker threads.
+// Otherwise archives are read one by one with regular file streams.
+//
+//=============================================================================
+#ifndef UWSAV__BATCH_H__
+#define UWSAV__BATCH_H__
+
+#include <functional>
+#include <string>
+#include <vector>
+#include "uwsav/uwsav_data.h"
+#include "uwsav/uwsav_levelcache.h"
+
+// Archive callback, receives the index of archive in the input list, the
+// game it belongs to, and levels read from it; ok is false if the archive
+// could not be read, or its game could not be detected.
+// The levels are shared among all the archives that have identical level
+// blocks, and so are immutable; they may be kept after the callback returns.
+typedef std::function<void(size_t index, const std::string &path, GameType game, bool ok,
+                           const std::vector<SharedLevel> &levels)> ArchiveCallback;
+
+// Reads levels from the list of archives; callback is called once per
+// archive, in the order of the input list, on the calling thread, while
+// the following archives are read on another thread.
+// If the game is kGameUnknown, then it is detected for each archive
+// separately, so the list may mix archives of different games.
+// Levels are shared through the given cache, which may be kept between the
+// batches; if none is given, the levels are shared within this batch only.
+void ReadArchivesBatch(const std::vector<std::string> &paths, GameType game,
+                       const ArchiveCallback &on_archive, LevelCache *cache = nullptr);
+
+#endif // UWSAV__BATCH_H__
@@ -0,0 +1,254 @@
+#include "uwsav_compress.h"
+#include <algorithm>
+#include <string.h>
+
+/*
+   A compressed block always starts with an Int32 value that is to be ignored.
+   If a block is actually compressed, it can be divided into subblocks.
+   Each compressed subblock starts with an Int8 number; the bits from LSB to
+   MSB describe if the following byte is just transferred to the target buffer
+   (bit set) or if we have a copy record (bit cleared). After 8 bytes or copy
+   record, the next subblock begins with an Int8 again.
+
+   The copy record starts with two Int8's:
+   0000   Int8   0..7: position, bits 0..7
+   0001   Int8   0..3: copy count
+                 4..7: position, bits 8..11
+
+   The copy count is 4 bits long and an offset of 3 is added to it. The
+   position has 12 bits (accessing the last 4k bytes) and an offset of 18 is
+   added. The sign bit is bit 11 and should be treated appropriate. As the
+   position field refers to a position in the current 4k segment, pointers
+   have to be adjusted, too. Then "copy count" bytes are copied from the
+   relative "position" to the current one.
+
+   Also used this for a reference (could not understand "copy record part"):
+   https://github.com/vividos/UnderworldAdventures/blob/main/uwadv/source/base/Uw2decode.cpp
+*/
+
+UW2BlockDecoder::UW2BlockDecoder(const uint8_t *data, size_t size)
+{
+    memset(_window, 0, sizeof(_window));
+    if (!data || size < sizeof(int32_t))
+        return;
+    _src = data + sizeof(int32_t); // unused?
+    _srcEnd = data + size;
+}
+
+size_t UW2BlockDecoder::Decode(const uint8_t *&out)
+{
+    const size_t start = _outPos % WindowSize;
+    size_t pos = start;
+    // Decode until the window end; the window is then reused from its start,
+    // which is safe, as the caller has finished with the previous piece
+    while (pos < WindowSize)
+    {
+        if (_copyCount > 0)
+        {
+            // Continue the copy record; it may be split between the pieces
+            _window[pos++] = _window[(_copyPos++) % WindowSize];
+            _copyCount--;
+            continue;
+        }
+
+        if (_flagBit == 8u)
+        {
+            if (_src == _srcEnd)
+                break;
+            _flags = *(_src++);
+            _flagBit = 0u;
+        }
+
+        if (_flags & (1 << _flagBit))
+        {
+            // Direct copy byte
+            if (_src == _srcEnd)
+                break;
+            _window[pos++] = *(_src++);
+        }
+        else
+        {
+            // Copy "record": this means copy previously written *uncompressed* data
+            if (_srcEnd - _src < 2)
+            {
+                _src = _srcEnd; // truncated record
+                break;
+            }
+            int32_t i1 = *(_src++);
+            int32_t i2 = *(_src++);
+            int32_t position = i1 | ((i2 & 0xF0) << 4);
+            // correct for sign bit
+            if (position & 0x800)
+                position |= 0xFFFFF000;
+            // add magic hardcoded offsets
+            position += 18;
+            _copyCount = (i2 & 0x0F) + 3;
+
+            // adjust pos to current 4k segment
+            const int64_t out_size = _outPos + (pos - start);
+            int64_t abs_pos = position;
+            while (abs_pos < 0 || (out_size >= 4096 && abs_pos < out_size - 4096))
+                abs_pos += 4096;
+            _copyPos = static_cast<size_t>(abs_pos);
+        }
+        _flagBit++;
+    }
+
+    const size_t decoded = pos - start;
+    _outPos += decoded;
+    out = &_window[start];
+    return decoded;
+}
+
+bool UncompressUW2Block(const uint8_t *data, size_t size, std::vector<uint8_t> &out_data)
+{
+    out_data.reserve(out_data.size() + size);
+    UW2BlockDecoder decoder(data, size);
+    const uint8_t *piece;
+    for (size_t piece_size = decoder.Decode(piece); piece_size > 0; piece_size = decoder.Decode(piece))
+        out_data.insert(out_data.end(), piece, piece + piece_size);
+    return true;
+}
+
+// Encoder settings for each compression level
+struct EncoderLevel
+{
+    unsigned MaxChain;
+    bool     Lazy;
+};
+
+static const EncoderLevel EncoderLevels[UW2BlockEncoder::MaxLevel + 1] = {
+    { 0u, false }, { 1u, false }, { 4u, false }, { 8u, false }, { 16u, true },
+    { 32u, true }, { 64u, true }, { 128u, true }, { 512u, true }, { 4096u, true }
+};
+
+// Farthest distance of the copy source from the current position;
+// the copy record may address the whole window, but the distance of
+// exactly 4k is interpreted differently by the decoders, so it's avoided
+static const size_t MaxCopyDistance = UW2BlockDecoder::WindowSize - 1;
+// Magic offset added to the copy record position, see above
+static const size_t CopyPositionOffset = 18u;
+
+UW2BlockEncoder::UW2BlockEncoder(int level)
+{
+    if (level < MinLevel)
+        level = MinLevel;
+    else if (level > MaxLevel)
+        level = MaxLevel;
+    _maxChain = EncoderLevels[level].MaxChain;
+    _lazy = EncoderLevels[level].Lazy;
+}
+
+void UW2BlockEncoder::Encode(const uint8_t *data, size_t size, std::vector<uint8_t> &out_data)
+{
+    _data = data;
+    _size = size;
+    memset(_head, 0, sizeof(_head));
+
+    // The leading Int32 is ignored by the decoder; put uncompressed size there
+    out_data.reserve(out_data.size() + sizeof(int32_t) + size + (size + 7) / 8);
+    for (size_t i = 0; i < sizeof(int32_t); ++i)
+        out_data.push_back(static_cast<uint8_t>(size >> (i * 8)));
+
+    size_t flag_pos = 0u; // flag byte of the current subblock
+    unsigned flag_bit = 8u; // next bit in the flag byte; 8 means start a new one
+    size_t inserted = 0u; // positions below this are in the hash chains
+    size_t pos = 0u;
+    while (pos < size)
+    {
+        size_t match_pos = 0u;
+        size_t match_len = 0u;
+        if (_maxChain > 0)
+        {
+            for (; inserted < pos; ++inserted)
+                Insert(inserted);
+            match_len = FindMatch(pos, match_pos);
+            // Lazy matching: if the next position has a longer copy,
+            // then write this byte directly, and take that copy instead
+            if (_lazy && match_len > 0 && match_len < MaxCopy)
+            {
+                Insert(inserted++);
+                size_t next_pos;
+                if (FindMatch(pos + 1, next_pos) > match_len)
+                    match_len = 0u;
+            }
+        }
+
+        if (flag_bit == 8u)
+        {
+            flag_pos = out_data.size();
+            out_data.push_back(0u);
+            flag_bit = 0u;
+        }
+        if (match_len > 0)
+        {
+            // Copy record, see the format description above
+            const size_t position = (match_pos - CopyPositionOffset) & 0xFFF;
+            out_data.push_back(static_cast<uint8_t>(position & 0xFF));
+            out_data.push_back(static_cast<uint8_t>(((position >> 4) & 0xF0) | (match_len - MinCopy)));
+            pos += match_len;
+        }
+        else
+        {
+            // Direct copy byte
+            out_data[flag_pos] |= static_cast<uint8_t>(1u << flag_bit);
+            out_data.push_back(data[pos++]);
+        }
+        flag_bit++;
+    }
+}
+
+// Hashes the first bytes of a copy, starting at the position
+static inline uint32_t HashCopyStart(const uint8_t *data, size_t hash_bits)
+{
+    const uint32_t v = (data[0] << 16) | (data[1] << 8) | data[2];
+    return (v * 2654435761u) >> (32 - hash_bits);
+}
+
+void UW2BlockEncoder::Insert(size_t pos)
+{
+    if (pos + MinCopy > _size)
+        return;
+    const uint32_t hash = HashCopyStart(_data + pos, HashBits);
+    _prev[pos % UW2BlockDecoder::WindowSize] = _head[hash];
+    _head[hash] = static_cast<uint32_t>(pos + 1);
+}
+
+size_t UW2BlockEncoder::FindMatch(size_t pos, size_t &match_pos) const
+{
+    if (pos + MinCopy > _size)
+        return 0u;
+    const size_t max_len = std::min(_size - pos, static_cast<size_t>(MaxCopy));
+    const size_t min_pos = (pos > MaxCopyDistance) ? pos - MaxCopyDistance : 0u;
+    const uint8_t *cur = _data + pos;
+    size_t best_len = 0u;
+    unsigned chain = _maxChain;
+    // Chained positions only decrease, so the walk stops on the first one
+    // that is out of the window; the ones in the window are never stale
+    for (uint32_t next = _head[HashCopyStart(cur, HashBits)];
+         next > 0 && next - 1 >= min_pos && chain > 0;
+         next = _prev[(next - 1) % UW2BlockDecoder::WindowSize], --chain)
+    {
+        const uint8_t *cand = _data + next - 1;
+        if (cand[best_len] != cur[best_len])
+            continue; // cannot be longer than the best
+        size_t len = 0u;
+        while (len < max_len && cand[len] == cur[len])
+            len++;
+        if (len > best_len)
+        {
+            best_len = len;
+            match_pos = next - 1;
+            if (len == max_len)
+                break;
+        }
+    }
+    return (best_len >= MinCopy) ? best_len : 0u;
+}
+
+bool CompressUW2Block(const uint8_t *data, size_t size, std::vector<uint8_t> &out_data, int level)
+{
+    UW2BlockEncoder encoder(level);
+    encoder.Encode(data, size, out_data);
+    return true;
+}
@@ -0,0 +1,105 @@
+//=============================================================================
+//
+// UW2 block compression.
+//
+// UW2 level blocks may be compressed with a LZSS-like scheme, where copy
+// records refer to the last 4k of the uncompressed data. This lets decode
+// a block incrementally, keeping only a 4k window of the output in memory.
+//
+// The encoder finds copy sources with hash chains: positions in the window
+// are chained by the hash of their first 3 bytes, so only the positions
+// that may start a match are compared. The compression level limits the
+// length of the chains walked, trading speed for size.
+//
+//=============================================================================
+#ifndef UWSAV__COMPRESS_H__
+#define UWSAV__COMPRESS_H__
+
+#include <stddef.h>
+#include <stdint.h>
+#include <vector>
+
+// Incremental decoder of a compressed UW2 block.
+// Decompresses the data into a fixed window, piece by piece; each piece
+// is valid only until the next call to Decode.
+// Does not own the compressed data, which *must* persist while decoding.
+class UW2BlockDecoder
+{
+public:
+    // Size of the window, which is also the farthest distance of a copy record
+    static const size_t WindowSize = 4096u;
+
+    UW2BlockDecoder(const uint8_t *data, size_t size);
+
+    // Decodes next piece of data, and assigns a pointer to it;
+    // returns the size of the piece, or 0 when the end of data was reached
+    size_t  Decode(const uint8_t *&out);
+    // Returns total number of bytes decoded so far
+    size_t  GetOutputSize() const { return _outPos; }
+
+private:
+    UW2BlockDecoder(const UW2BlockDecoder&) = delete;
+    UW2BlockDecoder &operator=(const UW2BlockDecoder&) = delete;
+
+    const uint8_t *_src = nullptr;
+    const uint8_t *_srcEnd = nullptr;
+    size_t   _outPos = 0u; // total bytes decoded
+    uint8_t  _flags = 0u; // current flag byte
+    unsigned _flagBit = 8u; // next bit in the flag byte; 8 means read a new one
+    size_t   _copyPos = 0u; // source of the copy record in progress
+    unsigned _copyCount = 0u; // bytes left to copy
+    uint8_t  _window[WindowSize];
+};
+
+// Decompresses the whole UW2 block, appends result to out_data
+bool UncompressUW2Block(const uint8_t *data, size_t size, std::vector<uint8_t> &out_data);
+
+// Encoder of UW2 blocks.
+// Keeps the match finder tables between the blocks, so one encoder may be
+// reused to compress many blocks without allocating.
+class UW2BlockEncoder
+{
+public:
+    // Compression levels: 0 stores all bytes as is, 1 is the fastest,
+    // 9 searches for the longest copies
+    static const int MinLevel = 0;
+    static const int MaxLevel = 9;
+    static const int DefaultLevel = 6;
+    // Copy record limits
+    static const size_t MinCopy = 3u;
+    static const size_t MaxCopy = 18u;
+
+    UW2BlockEncoder(int level = DefaultLevel);
+
+    // Compresses the whole block, appends result to out_data
+    void    Encode(const uint8_t *data, size_t size, std::vector<uint8_t> &out_data);
+
+private:
+    UW2BlockEncoder(const UW2BlockEncoder&) = delete;
+    UW2BlockEncoder &operator=(const UW2BlockEncoder&) = delete;
+
+    static const size_t HashBits = 12u;
+    static const size_t HashSize = 1u << HashBits;
+
+    // Adds the position to the hash chains
+    void    Insert(size_t pos);
+    // Finds the longest copy for the position; returns its length,
+    // or 0 if there's none
+    size_t  FindMatch(size_t pos, size_t &match_pos) const;
+
+    const uint8_t *_data = nullptr;
+    size_t   _size = 0u;
+    unsigned _maxChain = 0u; // max number of positions compared for a match
+    bool     _lazy = false; // try a longer match at the next position
+    // Last position with each hash, and the previous position with the same
+    // hash for each position in the window; positions are stored + 1,
+    // so that 0 means none
+    uint32_t _head[HashSize];
+    uint32_t _prev[UW2BlockDecoder::WindowSize];
+};
+
+// Compresses the whole UW2 block, appends result to out_data
+bool CompressUW2Block(const uint8_t *data, size_t size, std::vector<uint8_t> &out_data,
+                      int level = UW2BlockEncoder::DefaultLevel);
+
+#endif // UWSAV__COMPRESS_H__
@@ -1,5 +1,10 @@
-#include <assert.h>
+#include <algorithm>
+#include <string.h>
 #include "uwsav_data.h"
+#include "uwsav_compress.h"
+#include "utils/binaryreader.h"
+#include "utils/bitfield.h"
+#include "utils/crc32c.h"
 #include "utils/memorystream.h"
 
 // Various constants; UW format has many things fixed in size and number.
@@ -8,30 +13,6 @@ const uint16_t MobileObjectsLimit    = 256;
 const uint16_t StaticObjectsLimit    = 768;
 const uint16_t TotalObjectsLimit     = (MobileObjectsLimit + StaticObjectsLimit);
 
-// General file block info
-/*
-    The file is a container for several differently-sized blocks that contain
-    different infos of the level maps. Some blocks may be unused, e.g. automap
-    blocks.
-
-    The file header looks like this:
-
-    0000   Int16   number of blocks in file
-    0002   Int32   file offset to block 0
-    0006   Int32   file offset to block 1
-    ...            etc.
-*/
-
-struct DataBlockInfo
-{
-    uint32_t Index = 0u;
-    uint32_t Offset = 0u;
-    bool     IsCompressed = false; // UW2
-    bool     HasAvailSpace = false; // UW2
-    uint32_t Size = 0u;
-    uint32_t AvailSpace = 0u; // UW2
-};
-
 // Packed Tile data
 /*
     For each tile there are two Int16 that describe a tile's properties.
@@ -57,6 +38,19 @@ struct TileDataPacked
     uint16_t data2 = 0u;
 };
 
+// Tile data fields
+namespace TileField
+{
+    typedef PackedField<TileDataPacked, uint16_t, &TileDataPacked::data1, 0, 4>  Type;
+    typedef PackedField<TileDataPacked, uint16_t, &TileDataPacked::data1, 4, 4>  FloorHeight;
+    typedef PackedField<TileDataPacked, uint16_t, &TileDataPacked::data1, 8, 1>  Unknown;
+    typedef PackedField<TileDataPacked, uint16_t, &TileDataPacked::data1, 10, 4> FloorTexture;
+    typedef PackedField<TileDataPacked, uint16_t, &TileDataPacked::data1, 14, 1> NoMagic;
+    typedef PackedField<TileDataPacked, uint16_t, &TileDataPacked::data1, 15, 1> Door;
+    typedef PackedField<TileDataPacked, uint16_t, &TileDataPacked::data2, 0, 6>  WallTexture;
+    typedef PackedField<TileDataPacked, uint16_t, &TileDataPacked::data2, 6, 10> FirstObject;
+}
+
 // Packed Object data
 /*
     The "general object info" block looks as following:
@@ -92,17 +86,90 @@ struct ObjectDataPacked
     uint16_t data2 = 0u;
     uint16_t data3 = 0u;
     uint16_t data4 = 0u;
-    // mobile info ... todo
+    // mobile info is in NpcDataPacked
 };
 
+// Object data fields
+namespace ObjectField
+{
+    typedef PackedField<ObjectDataPacked, uint16_t, &ObjectDataPacked::data1, 0, 9>  ItemID;
+    typedef PackedField<ObjectDataPacked, uint16_t, &ObjectDataPacked::data1, 9, 4>  Flags;
+    typedef PackedField<ObjectDataPacked, uint16_t, &ObjectDataPacked::data1, 12, 1> Enchant;
+    typedef PackedField<ObjectDataPacked, uint16_t, &ObjectDataPacked::data1, 13, 1> DoorDir;
+    typedef PackedField<ObjectDataPacked, uint16_t, &ObjectDataPacked::data1, 14, 1> Invisible;
+    typedef PackedField<ObjectDataPacked, uint16_t, &ObjectDataPacked::data1, 15, 1> IsQuant;
+    typedef PackedField<ObjectDataPacked, uint16_t, &ObjectDataPacked::data2, 0, 7>  ZPos;
+    typedef PackedField<ObjectDataPacked, uint16_t, &ObjectDataPacked::data2, 7, 3>  Heading;
+    typedef PackedField<ObjectDataPacked, uint16_t, &ObjectDataPacked::data2, 10, 3> YPos;
+    typedef PackedField<ObjectDataPacked, uint16_t, &ObjectDataPacked::data2, 13, 3> XPos;
+    typedef PackedField<ObjectDataPacked, uint16_t, &ObjectDataPacked::data3, 0, 6>  Quality;
+    typedef PackedField<ObjectDataPacked, uint16_t, &ObjectDataPacked::data3, 6, 10> Next;
+    typedef PackedField<ObjectDataPacked, uint16_t, &ObjectDataPacked::data4, 0, 6>  Owner;
+    typedef PackedField<ObjectDataPacked, uint16_t, &ObjectDataPacked::data4, 6, 10> Special;
+}
+
+// Packed mobile object extended data
+/*
+    Mobile objects have 19 more bytes after the general object info.
+    Offsets here are given from the start of the mobile object record.
+
+    0008   Int8   npc_hp
+    0009   Int8   unknown
+    000a   Int8   unknown
+    000b   Int16  0- 3  npc_goal
+                  4-11  npc_gtarg
+                  12-15 unknown
+    000d   Int16  0- 3  npc_level
+                  4-12  unknown
+                  13    npc_talkedto
+                  14-15 npc_attitude (0 hostile, 1 upset, 2 mellow, 3 friendly)
+    000f   Int16  unknown
+    0011   Int8   unknown (5 bytes)
+    0016   Int16  0- 3  unknown
+                  4- 9  npc_yhome
+                  10-15 npc_xhome
+    0018   Int8   unknown
+    0019   Int8   0- 6  npc_hunger
+    001a   Int8   npc_whoami (conversation slot)
+
+    Many of the fields are not well researched; UW2 uses the same layout
+    for the known ones.
+*/
+struct NpcDataPacked
+{
+    uint8_t  hp = 0u;
+    uint16_t goal = 0u; // 000b
+    uint16_t level = 0u; // 000d
+    uint16_t home = 0u; // 0016
+    uint8_t  hunger = 0u; // 0019
+    uint8_t  whoami = 0u; // 001a
+};
+
+// NPC data fields
+namespace NpcField
+{
+    typedef PackedField<NpcDataPacked, uint16_t, &NpcDataPacked::goal, 0, 4>   Goal;
+    typedef PackedField<NpcDataPacked, uint16_t, &NpcDataPacked::goal, 4, 8>   GoalTarget;
+    typedef PackedField<NpcDataPacked, uint16_t, &NpcDataPacked::level, 0, 4>  Level;
+    typedef PackedField<NpcDataPacked, uint16_t, &NpcDataPacked::level, 13, 1> TalkedTo;
+    typedef PackedField<NpcDataPacked, uint16_t, &NpcDataPacked::level, 14, 2> Attitude;
+    typedef PackedField<NpcDataPacked, uint16_t, &NpcDataPacked::home, 4, 6>   YHome;
+    typedef PackedField<NpcDataPacked, uint16_t, &NpcDataPacked::home, 10, 6>  XHome;
+    typedef PackedField<NpcDataPacked, uint8_t, &NpcDataPacked::hunger, 0, 7>  Hunger;
+}
+
 
 // Unpacks packed tile data into the TileData struct
 static TileData UnpackTileData(const TileDataPacked& ptile)
 {
     TileData tile;
-    tile.Type = static_cast<TileType>(ptile.data1 & 0x7);
-    tile.IsDoor = (ptile.data1 & 0x8000) != 0;
-    tile.FirstObjLink = (ptile.data2 >> 6) & 0x3FF;
+    tile.Type = static_cast<TileType>(TileField::Type::Get(ptile));
+    tile.FloorHeight = static_cast<uint8_t>(TileField::FloorHeight::Get(ptile));
+    tile.FloorTexture = static_cast<uint8_t>(TileField::FloorTexture::Get(ptile));
+    tile.WallTexture = static_cast<uint8_t>(TileField::WallTexture::Get(ptile));
+    tile.NoMagic = TileField::NoMagic::Get(ptile) != 0;
+    tile.IsDoor = TileField::Door::Get(ptile) != 0;
+    tile.FirstObjLink = TileField::FirstObject::Get(ptile);
     return tile;
 }
 
@@ -110,9 +177,18 @@ static TileData UnpackTileData(const TileDataPacked& ptile)
 static ObjectData UnpackObjectData(const ObjectDataPacked& pobj)
 {
     ObjectData obj;
-    obj.ItemID = pobj.data1 & 0x1FF;
-    obj.Flags = (pobj.data1 >> 9) & 0xF;
-    obj.NextObjLink = (pobj.data3 >> 6) & 0x3FF;
+    obj.ItemID = ObjectField::ItemID::Get(pobj);
+    obj.Flags = ObjectField::Flags::Get(pobj);
+    obj.IsEnchanted = ObjectField::Enchant::Get(pobj) != 0;
+    obj.DoorDir = ObjectField::DoorDir::Get(pobj) != 0;
+    obj.IsInvisible = ObjectField::Invisible::Get(pobj) != 0;
+    obj.XPos = static_cast<uint8_t>(ObjectField::XPos::Get(pobj));
+    obj.YPos = static_cast<uint8_t>(ObjectField::YPos::Get(pobj));
+    obj.ZPos = static_cast<uint8_t>(ObjectField::ZPos::Get(pobj));
+    obj.Heading = static_cast<uint8_t>(ObjectField::Heading::Get(pobj));
+    obj.Quality = static_cast<uint8_t>(ObjectField::Quality::Get(pobj));
+    obj.Owner = static_cast<uint8_t>(ObjectField::Owner::Get(pobj));
+    obj.NextObjLink = ObjectField::Next::Get(pobj);
 
     /*
         If the "is_quant" field is 0 (unset), it contains the index of an associated
@@ -123,8 +199,9 @@ static ObjectData UnpackObjectData(const ObjectDataPacked& pobj)
         If the value is > 512, the value minus 512 is a special property; the
         object type defines the further meaning of this value.
     */
-    bool is_quant = (pobj.data1 & 0x8000) != 0;
-    uint16_t special = (pobj.data4 >> 6) & 0x3FF;
+    bool is_quant = ObjectField::IsQuant::Get(pobj) != 0;
+    uint16_t special = ObjectField::Special::Get(pobj);
+    obj.IsQuantity = is_quant;
     if (is_quant && special < 512)
         obj.Quantity = special;
     else if (is_quant && special > 512)
@@ -134,9 +211,128 @@ static ObjectData UnpackObjectData(const ObjectDataPacked& pobj)
     return obj;
 }
 
-// Reads tilemap + master object list of a single level
-static void ReadLevelTilemap(Stream &in, LevelData &levelinfo)
+// Packs the TileData struct into the packed tile data;
+// fields not present in TileData are kept as they are
+static void PackTileData(const TileData &tile, TileDataPacked &ptile)
 {
+    TileField::Type::Set(ptile, static_cast<uint16_t>(tile.Type));
+    TileField::FloorHeight::Set(ptile, tile.FloorHeight);
+    TileField::FloorTexture::Set(ptile, tile.FloorTexture);
+    TileField::WallTexture::Set(ptile, tile.WallTexture);
+    TileField::NoMagic::Set(ptile, tile.NoMagic ? 1u : 0u);
+    TileField::Door::Set(ptile, tile.IsDoor ? 1u : 0u);
+    TileField::FirstObject::Set(ptile, tile.FirstObjLink);
+}
+
+// Packs the ObjectData struct into the packed object data
+static void PackObjectData(const ObjectData &obj, ObjectDataPacked &pobj)
+{
+    // Several special field values unpack into the same quantity (see above),
+    // so the field is only repacked if its unpacked meaning has changed
+    const ObjectData old = UnpackObjectData(pobj);
+    if (obj.IsQuantity != old.IsQuantity || obj.Quantity != old.Quantity ||
+        obj.SpecialLink != old.SpecialLink || obj.SpecialProperty != old.SpecialProperty)
+    {
+        uint16_t special;
+        if (!obj.IsQuantity)
+            special = obj.SpecialLink;
+        else if (obj.SpecialProperty > 0)
+            special = obj.SpecialProperty + 512;
+        else
+            special = obj.Quantity;
+        ObjectField::IsQuant::Set(pobj, obj.IsQuantity ? 1u : 0u);
+        ObjectField::Special::Set(pobj, special);
+    }
+
+    ObjectField::ItemID::Set(pobj, obj.ItemID);
+    ObjectField::Flags::Set(pobj, obj.Flags);
+    ObjectField::Enchant::Set(pobj, obj.IsEnchanted ? 1u : 0u);
+    ObjectField::DoorDir::Set(pobj, obj.DoorDir ? 1u : 0u);
+    ObjectField::Invisible::Set(pobj, obj.IsInvisible ? 1u : 0u);
+    ObjectField::XPos::Set(pobj, obj.XPos);
+    ObjectField::YPos::Set(pobj, obj.YPos);
+    ObjectField::ZPos::Set(pobj, obj.ZPos);
+    ObjectField::Heading::Set(pobj, obj.Heading);
+    ObjectField::Quality::Set(pobj, obj.Quality);
+    ObjectField::Owner::Set(pobj, obj.Owner);
+    ObjectField::Next::Set(pobj, obj.NextObjLink);
+}
+
+// Reads packed NPC data from the raw mobile extended data
+static NpcDataPacked ReadNpcDataPacked(const uint8_t *data)
+{
+    BinaryReader in(data, LevelData::MobileExtraSize);
+    NpcDataPacked pnpc;
+    pnpc.hp = in.ReadInt8();
+    in.Seek(0x0b - 0x08);
+    pnpc.goal = in.ReadInt16LE();
+    pnpc.level = in.ReadInt16LE();
+    in.Seek(0x16 - 0x08);
+    pnpc.home = in.ReadInt16LE();
+    in.Skip(1);
+    pnpc.hunger = in.ReadInt8();
+    pnpc.whoami = in.ReadInt8();
+    return pnpc;
+}
+
+// Unpacks packed NPC data into the NpcData struct
+static NpcData UnpackNpcData(const NpcDataPacked &pnpc)
+{
+    NpcData npc;
+    npc.HP = pnpc.hp;
+    npc.Goal = static_cast<uint8_t>(NpcField::Goal::Get(pnpc));
+    npc.GoalTarget = static_cast<uint8_t>(NpcField::GoalTarget::Get(pnpc));
+    npc.Level = static_cast<uint8_t>(NpcField::Level::Get(pnpc));
+    npc.TalkedTo = NpcField::TalkedTo::Get(pnpc) != 0;
+    npc.Attitude = static_cast<NpcAttitude>(NpcField::Attitude::Get(pnpc));
+    npc.XHome = static_cast<uint8_t>(NpcField::XHome::Get(pnpc));
+    npc.YHome = static_cast<uint8_t>(NpcField::YHome::Get(pnpc));
+    npc.Hunger = NpcField::Hunger::Get(pnpc);
+    npc.WhoAmI = pnpc.whoami;
+    return npc;
+}
+
+NpcData LevelData::GetNpcData(uint16_t obj_index) const
+{
+    const size_t offset = obj_index * MobileExtraSize;
+    if (obj_index >= MaxMobiles || offset + MobileExtraSize > mobile_extra.size())
+        return NpcData();
+    return UnpackNpcData(ReadNpcDataPacked(&mobile_extra[offset]));
+}
+
+void AppendNpcColumns(const LevelData &level, NpcColumns &npcs)
+{
+    const uint16_t mobile_num = static_cast<uint16_t>(
+        std::min<size_t>(level.objs.size(), LevelData::MaxMobiles));
+    std::vector<bool> is_free(LevelData::MaxMobiles);
+    for (uint16_t slot : level.free_mobiles)
+    {
+        if (slot < LevelData::MaxMobiles)
+            is_free[slot] = true;
+    }
+    // Slot 0 is never used, slot 1 is reserved for the player
+    for (uint16_t i = 2; i < mobile_num; ++i)
+    {
+        const ObjectData &obj = level.objs[i];
+        if (is_free[i] || !IsNpcItem(obj.ItemID))
+            continue;
+        const NpcData npc = level.GetNpcData(i);
+        npcs.WorldID.push_back(level.WorldID);
+        npcs.LevelID.push_back(level.LevelID);
+        npcs.ObjIndex.push_back(i);
+        npcs.ItemID.push_back(obj.ItemID);
+        npcs.HP.push_back(npc.HP);
+        npcs.Goal.push_back(npc.Goal);
+        npcs.GoalTarget.push_back(npc.GoalTarget);
+        npcs.Level.push_back(npc.Level);
+        npcs.Attitude.push_back(npc.Attitude);
+        npcs.XHome.push_back(npc.XHome);
+        npcs.YHome.push_back(npc.YHome);
+        npcs.WhoAmI.push_back(npc.WhoAmI);
+    }
+}
+
+// Parser of the tilemap + master object list of a single level
 /*
     The first 0x4000 bytes of each "level tilemap/master object list" contain
     the tilemap info bytes.
@@ -147,211 +343,763 @@ static void ReadLevelTilemap(Stream &in, LevelData &levelinfo)
 
     mobile object information (objects 0000-00ff, 256 x 27 bytes)
     static object information (objects 0100-03ff, 768 x 8 bytes)
+
+    Then follow the free lists of the object slots, and their sizes:
+
+    7300   Int16[254]  free list of mobile object slots (2-255)
+    74fc   Int16[768]  free list of static object slots
+    7afc   Int8[0x106] unknown
+    7c02   Int16       number of free mobile slots, minus 1
+    7c04   Int16       number of free static slots, minus 1
+    7c06   Int16       0x7775 (end marker?)
+
+    The block data is fed to the parser in pieces of any size, which lets
+    parse it as it is being decompressed. The records are parsed as soon as
+    they are complete; a record split between the pieces is gathered in a
+    small stash. If the block is truncated, then the missing records are
+    left empty.
 */
-    const uint16_t tile_num = 64 * 64;
-    std::vector<TileDataPacked> tiles(tile_num);
-    for (uint16_t i = 0; i < tile_num; ++i)
+// Level tilemap block layout
+const size_t TileNum         = 64 * 64;
+const size_t TileSize        = sizeof(int16_t) * 2;
+const size_t ObjSize         = sizeof(int16_t) * 4;
+const size_t MobileExtraSize = LevelData::MobileExtraSize;
+const size_t MobileSize      = ObjSize + MobileExtraSize;
+// The rest of the block after the objects is read as Int16 words
+const size_t MobileFreeNum   = MobileObjectsLimit - 2;
+const size_t StaticFreeNum   = StaticObjectsLimit;
+const size_t UnknownWordNum  = 0x106 / sizeof(int16_t);
+const size_t TailWordNum     = MobileFreeNum + StaticFreeNum + UnknownWordNum + 3;
+// Records are counted in a row: tiles, objects and the tail words
+const size_t TailStart       = TileNum + TotalObjectsLimit;
+const size_t RecordNum       = TailStart + TailWordNum;
+// Max records unpacked at once from a bulk read
+const size_t ChunkNum        = 256;
+
+// Packed tables are read as whole arrays of Int16
+static_assert(sizeof(TileDataPacked) == TileSize, "TileDataPacked must have no padding");
+static_assert(sizeof(ObjectDataPacked) == ObjSize, "ObjectDataPacked must have no padding");
+static_assert(TileNum * TileSize + MobileObjectsLimit * MobileSize + StaticObjectsLimit * ObjSize +
+              TailWordNum * sizeof(int16_t) == LevelTilemapBlockSize, "Level tilemap block layout mismatch");
+
+class LevelTilemapParser
+{
+public:
+    LevelTilemapParser(LevelData &level)
+        : _level(level)
     {
-        tiles[i].data1 = in.ReadInt16LE();
-        tiles[i].data2 = in.ReadInt16LE();
+        _level.tiles.assign(TileNum, UnpackTileData(TileDataPacked()));
+        _level.objs.assign(TotalObjectsLimit, UnpackObjectData(ObjectDataPacked()));
+        _level.mobile_extra.assign(MobileObjectsLimit * MobileExtraSize, 0u);
+        _level.free_mobiles.clear();
+        _level.free_statics.clear();
+        _level.HasFreeLists = false;
     }
 
-    std::vector<ObjectDataPacked> objs(TotalObjectsLimit);
-    // Mobile objects: have general obj data + mobile data
-    for (uint16_t i = 0; i < MobileObjectsLimit; ++i)
+    // Tells if all the records were parsed
+    bool IsDone() const { return _record == RecordNum; }
+
+    // Parses next piece of the block data
+    void Feed(const uint8_t *data, size_t size)
     {
-        objs[i].data1 = in.ReadInt16LE();
-        objs[i].data2 = in.ReadInt16LE();
-        objs[i].data3 = in.ReadInt16LE();
-        objs[i].data4 = in.ReadInt16LE();
-        // mobile info, skip for now
-        in.Seek(19, kSeekCurrent);
+        while (size > 0 && !IsDone())
+        {
+            const size_t rec_size = GetRecordSize();
+            if (_stashed > 0 || size < rec_size)
+            {
+                // Gather a record split between the pieces
+                const size_t n = std::min(rec_size - _stashed, size);
+                memcpy(&_stash[_stashed], data, n);
+                _stashed += n;
+                data += n;
+                size -= n;
+                if (_stashed == rec_size)
+                {
+                    BinaryReader in(_stash, rec_size);
+                    ParseRecords(in);
+                    _stashed = 0u;
+                }
+            }
+            else
+            {
+                BinaryReader in(data, size);
+                ParseRecords(in);
+                data += in.GetPosition();
+                size -= in.GetPosition();
+            }
+        }
+    }
+
+private:
+    // Returns size of the next record
+    size_t GetRecordSize() const
+    {
+        if (_record < TileNum)
+            return TileSize;
+        if (_record < TileNum + MobileObjectsLimit)
+            return MobileSize;
+        if (_record < TailStart)
+            return ObjSize;
+        return sizeof(int16_t);
+    }
+
+    // Parses as many whole records as are available in the reader
+    void ParseRecords(BinaryReader &in)
+    {
+        while (!IsDone() && in.Require(GetRecordSize()))
+        {
+            if (_record < TileNum)
+            {
+                TileDataPacked tiles[ChunkNum];
+                const size_t count = std::min(std::min(TileNum - _record, ChunkNum),
+                                              in.GetRemaining() / TileSize);
+                in.ReadArrayInt16LE(reinterpret_cast<int16_t*>(tiles), count * 2);
+                for (size_t i = 0; i < count; ++i)
+                    _level.tiles[_record + i] = UnpackTileData(tiles[i]);
+                _record += count;
+            }
+            else if (_record < TileNum + MobileObjectsLimit)
+            {
+                // Mobile objects: have general obj data + mobile data
+                ObjectDataPacked obj;
+                in.ReadArrayInt16LE(reinterpret_cast<int16_t*>(&obj), 4);
+                // mobile info, kept raw and decoded on demand
+                in.Read(&_level.mobile_extra[(_record - TileNum) * MobileExtraSize], MobileExtraSize);
+                _level.objs[_record - TileNum] = UnpackObjectData(obj);
+                _record++;
+            }
+            else if (_record < TailStart)
+            {
+                // Static objects: have general obj data only
+                ObjectDataPacked objs[ChunkNum];
+                const size_t count = std::min(std::min(TailStart - _record, ChunkNum),
+                                              in.GetRemaining() / ObjSize);
+                in.ReadArrayInt16LE(reinterpret_cast<int16_t*>(objs), count * 4);
+                for (size_t i = 0; i < count; ++i)
+                    _level.objs[_record - TileNum + i] = UnpackObjectData(objs[i]);
+                _record += count;
+            }
+            else
+            {
+                // Free lists and the rest
+                const size_t count = std::min(RecordNum - _record, in.GetRemaining() / sizeof(int16_t));
+                in.ReadArrayInt16LE(&_tail[_record - TailStart], count);
+                _record += count;
+                if (IsDone())
+                    UnpackFreeLists();
+            }
+        }
+    }
+
+    // Unpacks free lists from the tail words
+    void UnpackFreeLists()
+    {
+        const int16_t *mobile_list = &_tail[0];
+        const int16_t *static_list = &_tail[MobileFreeNum];
+        const int16_t *counts = &_tail[MobileFreeNum + StaticFreeNum + UnknownWordNum];
+        const size_t mobile_count = std::min<size_t>(std::max(0, counts[0] + 1), MobileFreeNum);
+        const size_t static_count = std::min<size_t>(std::max(0, counts[1] + 1), StaticFreeNum);
+        _level.free_mobiles.assign(mobile_list, mobile_list + mobile_count);
+        _level.free_statics.assign(static_list, static_list + static_count);
+        _level.HasFreeLists = true;
+    }
+
+    LevelData &_level;
+    size_t  _record = 0u; // next record, counting tiles, objects and tail words in a row
+    uint8_t _stash[MobileSize]; // largest record
+    size_t  _stashed = 0u;
+    int16_t _tail[TailWordNum];
+};
+
+bool PackLevelBlock(const LevelData &level, uint8_t *data, size_t size)
+{
+    if (size < LevelTilemapBlockSize || level.tiles.size() < TileNum ||
+        level.objs.size() < TotalObjectsLimit)
+        return false;
+
+    // Records are read from the block, updated and written back in place
+    BinaryReader in(data, size);
+    Stream out(std::unique_ptr<StreamBase>(new MemoryStream(data, size, kStream_Write)));
+    for (size_t rec = 0; rec < TileNum; rec += ChunkNum)
+    {
+        TileDataPacked tiles[ChunkNum];
+        const size_t count = std::min(TileNum - rec, ChunkNum);
+        in.ReadArrayInt16LE(reinterpret_cast<int16_t*>(tiles), count * 2);
+        for (size_t i = 0; i < count; ++i)
+            PackTileData(level.tiles[rec + i], tiles[i]);
+        out.WriteArrayInt16LE(reinterpret_cast<int16_t*>(tiles), count * 2);
     }
-    // Static objects: have general obj data only
-    for (uint16_t i = MobileObjectsLimit; i < TotalObjectsLimit; ++i)
+    const bool has_mobile_extra = level.mobile_extra.size() >= MobileObjectsLimit * MobileExtraSize;
+    for (size_t i = 0; i < MobileObjectsLimit; ++i)
     {
-        objs[i].data1 = in.ReadInt16LE();
-        objs[i].data2 = in.ReadInt16LE();
-        objs[i].data3 = in.ReadInt16LE();
-        objs[i].data4 = in.ReadInt16LE();
+        ObjectDataPacked obj;
+        in.ReadArrayInt16LE(reinterpret_cast<int16_t*>(&obj), 4);
+        PackObjectData(level.objs[i], obj);
+        out.WriteArrayInt16LE(reinterpret_cast<int16_t*>(&obj), 4);
+        const uint8_t *extra = in.ReadBytes(MobileExtraSize);
+        if (has_mobile_extra)
+            extra = &level.mobile_extra[i * MobileExtraSize];
+        out.Write(extra, MobileExtraSize);
+    }
+    for (size_t rec = MobileObjectsLimit; rec < TotalObjectsLimit; rec += ChunkNum)
+    {
+        ObjectDataPacked objs[ChunkNum];
+        const size_t count = std::min(TotalObjectsLimit - rec, ChunkNum);
+        in.ReadArrayInt16LE(reinterpret_cast<int16_t*>(objs), count * 4);
+        for (size_t i = 0; i < count; ++i)
+            PackObjectData(level.objs[rec + i], objs[i]);
+        out.WriteArrayInt16LE(reinterpret_cast<int16_t*>(objs), count * 4);
     }
 
-    for (const auto ptile : tiles)
-        levelinfo.tiles.push_back(UnpackTileData(ptile));
-    for (const auto pobj: objs)
-        levelinfo.objs.push_back(UnpackObjectData(pobj));
+    // Free lists, and their sizes; the unused list entries are kept as they are
+    if (level.HasFreeLists)
+    {
+        int16_t tail[TailWordNum];
+        in.ReadArrayInt16LE(tail, TailWordNum);
+        const size_t mobile_count = std::min(level.free_mobiles.size(), MobileFreeNum);
+        const size_t static_count = std::min(level.free_statics.size(), StaticFreeNum);
+        std::copy_n(level.free_mobiles.begin(), mobile_count, &tail[0]);
+        std::copy_n(level.free_statics.begin(), static_count, &tail[MobileFreeNum]);
+        int16_t *counts = &tail[MobileFreeNum + StaticFreeNum + UnknownWordNum];
+        counts[0] = static_cast<int16_t>(mobile_count - 1);
+        counts[1] = static_cast<int16_t>(static_count - 1);
+        out.WriteArrayInt16LE(tail, TailWordNum);
+    }
+    return true;
 }
 
-void ReadLevelsUW1(Stream &in, std::vector<LevelData> &levels)
+
+// Archive format traits
+/*
+    Both games store levels in the same kind of block container, but the
+    header layout and the way level blocks are found in it differ.
+    Each game (or a game variant) is described by a traits struct, and
+    the archive reader is instantiated per traits, so that all the format
+    checks are resolved at compile time.
+
+    UW1 header:
+    0000   Int16   number of blocks in file
+    0002   Int32   file offset to block 0, block 1, etc
+
+    UW1 has no fixed block order for level maps, so these are identified
+    by their size. Block size is not stored, and is calculated as a
+    distance to the next block. Unused blocks have zero offset.
+
+    UW1 has 135 entries (9 levels x 15), but only 5 sets of 9 entries
+    are known to be used:
+
+       0.. 8  level maps
+       9..17  object animation overlays
+      18..26  texture mappings
+      27..35  automap infos
+      36..44  map notes
+
+    UW2 header:
+    0000   Int16   number of blocks in file
+    0002   Int32   unknown
+    0006   Int32   file offset to block 0, block 1, etc
+    ....   Int32   flags for each block:
+                   bit 1: block is compressed
+                   bit 2: block has extra available space
+    ....   Int32   data size of each block
+    ....   Int32   available space of each block
+
+    UW2 has 320 (0x0140) entries (80 levels x 4 blocks). These can be
+    split into 4 sets of 80 entries each:
+
+       0.. 79  level maps
+      80..159  texture mappings
+     160..239  automap infos
+     240..319  map notes
+
+    Level maps are stored as a grid of 10 worlds x 8 levels, and may be
+    compressed.
+
+    Each set of entries is called a "block group" below.
+*/
+struct UW1ArchiveTraits
 {
-    levels.clear();
+    // Has unknown Int32 right after the number of blocks
+    static const bool     HasHeaderExtra = false;
+    // Has flags, size and avail space tables after the offset table
+    static const bool     HasBlockTables = false;
+    // Level blocks may be compressed
+    static const bool     HasCompression = false;
+    // Level blocks are identified by their size, rather than index
+    static const bool     FindLevelsBySize = true;
+    // Number of blocks in the archive, if it's fixed
+    static const uint16_t BlockCount = 135u;
+    // Level block grid, used when not identifying levels by size
+    static const uint16_t WorldCount = 0u;
+    static const uint16_t LevelsPerWorld = 0u;
+    // Size of the level tilemap block (uncompressed)
+    static const uint32_t LevelBlockSize = LevelTilemapBlockSize;
+    // Number of entries in each block group, one per level
+    static const uint16_t BlockGroupSize = 9u;
+    // Returns kind of blocks in the block group
+    static BlockKind GetGroupKind(uint16_t group)
+    {
+        switch (group)
+        {
+        case 0: return kBlockLevel;
+        case 1: return kBlockAnimOverlay;
+        case 2: return kBlockTextureMap;
+        case 3: return kBlockAutomap;
+        case 4: return kBlockMapNotes;
+        default: return kBlockUnknown;
+        }
+    }
+};
+
+struct UW2ArchiveTraits
+{
+    static const bool     HasHeaderExtra = true;
+    static const bool     HasBlockTables = true;
+    static const bool     HasCompression = true;
+    static const bool     FindLevelsBySize = false;
+    static const uint16_t BlockCount = 320u;
+    static const uint16_t WorldCount = 10u;
+    static const uint16_t LevelsPerWorld = 8u;
+    static const uint32_t LevelBlockSize = LevelTilemapBlockSize;
+    static const uint16_t BlockGroupSize = WorldCount * LevelsPerWorld;
+    static BlockKind GetGroupKind(uint16_t group)
+    {
+        switch (group)
+        {
+        case 0: return kBlockLevel;
+        case 1: return kBlockTextureMap;
+        case 2: return kBlockAutomap;
+        case 3: return kBlockMapNotes;
+        default: return kBlockUnknown;
+        }
+    }
+};
 
+// Returns size of the archive header which has num_blocks entries
+template <typename TArchive>
+static constexpr size_t GetHeaderSize(uint16_t num_blocks)
+{
+    return sizeof(int16_t) + (TArchive::HasHeaderExtra ? sizeof(int32_t) : 0u) +
+        num_blocks * sizeof(int32_t) * (TArchive::HasBlockTables ? 4u : 1u);
+}
+
+// Reads the archive header, fills in DataBlockInfo array;
+// archive_len is the total length of the archive
+template <typename TArchive>
+static void ReadBlockDirectory(BinaryReader &in, soff_t archive_len, std::vector<DataBlockInfo> &blocks)
+{
+    blocks.clear();
+    if (!in.Require(sizeof(int16_t)))
+        return;
     uint16_t num_blocks = in.ReadInt16LE();
-    std::vector<DataBlockInfo> blocks(num_blocks);
+    if (!in.Require(GetHeaderSize<TArchive>(num_blocks) - sizeof(int16_t)))
+        return; // truncated header
+    if (TArchive::HasHeaderExtra)
+        in.ReadInt32LE(); // skip unknown
+    blocks.resize(num_blocks);
+    // The tables are read as whole arrays of Int32
+    std::vector<int32_t> table(num_blocks);
+    in.ReadArrayInt32LE(table.data(), num_blocks);
     for (uint16_t i = 0; i < num_blocks; ++i)
     {
         blocks[i].Index = i;
-        blocks[i].Offset = in.ReadInt32LE();
+        blocks[i].Offset = table[i];
     }
-    for (uint16_t i = 0; i < num_blocks - 1; ++i)
+
+    if (TArchive::HasBlockTables)
     {
-        blocks[i].Size = blocks[i + 1].Offset - blocks[i].Offset;
+        in.ReadArrayInt32LE(table.data(), num_blocks);
+        for (uint16_t i = 0; i < num_blocks; ++i)
+        {
+            uint32_t flags = table[i];
+            blocks[i].Flags = flags;
+            blocks[i].IsCompressed = flags & 0x2;
+            blocks[i].HasAvailSpace = flags & 0x4;
+        }
+        in.ReadArrayInt32LE(table.data(), num_blocks);
+        for (uint16_t i = 0; i < num_blocks; ++i)
+        {
+            blocks[i].Size = table[i];
+        }
+        in.ReadArrayInt32LE(table.data(), num_blocks);
+        for (uint16_t i = 0; i < num_blocks; ++i)
+        {
+            blocks[i].AvailSpace = table[i];
+        }
     }
-    blocks[num_blocks - 1].Size = static_cast<uint32_t>(in.GetLength() - blocks[num_blocks - 1].Offset);
+    else if (num_blocks > 0)
+    {
+        // Block ends where the next block in the file begins; unused blocks
+        // are skipped, as these have zero offset
+        std::vector<uint32_t> offsets;
+        for (const auto &block : blocks)
+        {
+            if (block.Offset > 0)
+                offsets.push_back(block.Offset);
+        }
+        std::sort(offsets.begin(), offsets.end());
+        for (auto &block : blocks)
+        {
+            if (block.Offset == 0)
+                continue;
+            auto next = std::upper_bound(offsets.begin(), offsets.end(), block.Offset);
+            const soff_t block_end = (next != offsets.end()) ? *next : archive_len;
+            block.Size = static_cast<uint32_t>(std::max<soff_t>(0, block_end - block.Offset));
+        }
+    }
+}
+
+// Block flags known to be used, see the header description above
+static const uint32_t KnownBlockFlags = 0x2 | 0x4;
 
-    uint8_t level_id = 1u;
+// Tells if the archive header matches the game described by the TArchive
+// traits; checks only the header itself, reading no blocks
+template <typename TArchive>
+static bool MatchArchiveHeader(const uint8_t *header, size_t header_size, soff_t archive_len)
+{
+    BinaryReader in(header, header_size);
+    std::vector<DataBlockInfo> blocks;
+    ReadBlockDirectory<TArchive>(in, archive_len, blocks);
+    if (blocks.empty() || blocks.size() != TArchive::BlockCount)
+        return false;
+    // Used blocks follow the header, in the order of the directory,
+    // and do not overlap
+    soff_t min_offset = GetHeaderSize<TArchive>(static_cast<uint16_t>(blocks.size()));
     for (const auto &block : blocks)
     {
-        // Block sizes are constant, we may use these to identify block type
-        if (block.Size != LevelTilemapBlockSize)
+        if (block.Offset == 0)
             continue;
+        if (block.Offset < min_offset)
+            return false;
+        min_offset = block.Offset + (TArchive::HasBlockTables ? block.Size : 0u);
+        if ((block.Flags & ~KnownBlockFlags) != 0)
+            return false;
+        // Uncompressed levels have a fixed size, except the last block,
+        // which may be cut by the end of file
+        const bool is_level = TArchive::GetGroupKind(block.Index / TArchive::BlockGroupSize) == kBlockLevel;
+        if (is_level && !block.IsCompressed && block.Size != TArchive::LevelBlockSize &&
+            block.Offset + block.Size < archive_len)
+            return false;
+    }
+    return true;
+}
+
+// Writes the block tables of the archive header, which follow the number of
+// blocks and the header extras
+template <typename TArchive>
+static void WriteBlockDirectory(Stream &out, const std::vector<DataBlockInfo> &blocks)
+{
+    const size_t num_blocks = blocks.size();
+    std::vector<int32_t> table(num_blocks);
+    for (size_t i = 0; i < num_blocks; ++i)
+        table[i] = blocks[i].Offset;
+    out.WriteArrayInt32LE(table.data(), num_blocks);
+    if (TArchive::HasBlockTables)
+    {
+        for (size_t i = 0; i < num_blocks; ++i)
+            table[i] = blocks[i].Flags;
+        out.WriteArrayInt32LE(table.data(), num_blocks);
+        for (size_t i = 0; i < num_blocks; ++i)
+            table[i] = blocks[i].Size;
+        out.WriteArrayInt32LE(table.data(), num_blocks);
+        for (size_t i = 0; i < num_blocks; ++i)
+            table[i] = blocks[i].AvailSpace;
+        out.WriteArrayInt32LE(table.data(), num_blocks);
+    }
+}
+
+// Decodes a single level block, decompressing it if necessary
+template <typename TArchive>
+static void DecodeLevelBlock(const uint8_t *data, size_t size, const DataBlockInfo &block, LevelData &level)
+{
+    LevelTilemapParser parser(level);
+    if (TArchive::HasCompression && block.IsCompressed)
+    {
+        // Parse the level as it is being decompressed, piece by piece
+        UW2BlockDecoder decoder(data, size);
+        const uint8_t *piece;
+        size_t piece_size;
+        while (!parser.IsDone() && (piece_size = decoder.Decode(piece)) > 0)
+            parser.Feed(piece, piece_size);
+    }
+    else
+    {
+        parser.Feed(data, size);
+    }
+}
 
+// Reads a single level block from the stream
+template <typename TArchive>
+static void ReadLevelBlock(Stream &in, const DataBlockInfo &block, LevelData &level)
+{
+    // Scratch buffer for the block data, reused by all reads on this thread
+    static thread_local std::vector<uint8_t> data;
+    in.Seek(block.Offset, kSeekBegin);
+    data.resize(block.Size);
+    const size_t was_read = in.Read(data.data(), block.Size);
+    DecodeLevelBlock<TArchive>(data.data(), was_read, block, level);
+}
+
+// Reads the archive header from the stream into the buffer
+template <typename TArchive>
+static void ReadHeader(Stream &in, std::vector<uint8_t> &header)
+{
+    in.Seek(0, kSeekBegin);
+    header.resize(sizeof(int16_t));
+    header.resize(in.Read(header.data(), header.size()));
+    if (header.size() < sizeof(int16_t))
+        return;
+    const uint16_t num_blocks = header[0] | (header[1] << 8);
+    const size_t header_size = GetHeaderSize<TArchive>(num_blocks);
+    header.resize(header_size);
+    header.resize(sizeof(int16_t) + in.Read(&header[sizeof(int16_t)], header_size - sizeof(int16_t)));
+}
+
+// Finds level blocks among the archive blocks
+template <typename TArchive>
+static void FindLevelBlocks(const std::vector<DataBlockInfo> &blocks, std::vector<LevelBlockInfo> &level_blocks)
+{
+    level_blocks.clear();
+    if (TArchive::FindLevelsBySize)
+    {
+        uint8_t level_id = 1u;
+        for (const auto &block : blocks)
+        {
+            // Block sizes are constant, we may use these to identify block type
+            if (block.Size != TArchive::LevelBlockSize)
+                continue;
+
+            LevelBlockInfo level_block;
+            level_block.Block = block;
+            level_block.LevelID = level_id++;
+            level_blocks.push_back(level_block);
+        }
+    }
+    else
+    {
+        const uint16_t grid_size = TArchive::WorldCount * TArchive::LevelsPerWorld;
+        for (uint16_t blk_index = 0; blk_index < grid_size && blk_index < blocks.size(); ++blk_index)
+        {
+            const auto &block = blocks[blk_index];
+            if (block.Offset == 0 || block.Size == 0)
+                continue; // unused
+
+            LevelBlockInfo level_block;
+            level_block.Block = block;
+            level_block.LevelID = (blk_index % TArchive::LevelsPerWorld) + 1;
+            level_block.WorldID = (blk_index / TArchive::LevelsPerWorld) + 1;
+            level_blocks.push_back(level_block);
+        }
+    }
+}
+
+// Reads archive header from the stream, fills in DataBlockInfo array
+template <typename TArchive>
+static void ReadBlockDirectory(Stream &in, std::vector<DataBlockInfo> &blocks)
+{
+    std::vector<uint8_t> header;
+    ReadHeader<TArchive>(in, header);
+    BinaryReader header_reader(header.data(), header.size());
+    ReadBlockDirectory<TArchive>(header_reader, in.GetLength(), blocks);
+}
+
+// Reads archive header from the stream and finds level blocks in it
+template <typename TArchive>
+static void ReadLevelDirectory(Stream &in, std::vector<LevelBlockInfo> &level_blocks)
+{
+    std::vector<DataBlockInfo> blocks;
+    ReadBlockDirectory<TArchive>(in, blocks);
+    FindLevelBlocks<TArchive>(blocks, level_blocks);
+}
+
+// Reads LEVEL.ARK file of the game described by the TArchive traits
+template <typename TArchive>
+static void ReadLevels(Stream &in, std::vector<LevelData> &levels)
+{
+    levels.clear();
+
+    std::vector<LevelBlockInfo> level_blocks;
+    ReadLevelDirectory<TArchive>(in, level_blocks);
+
+    levels.reserve(level_blocks.size());
+    for (const auto &level_block : level_blocks)
+    {
         LevelData level;
-        level.LevelID = level_id++;
-        in.Seek(block.Offset, kSeekBegin);
-        ReadLevelTilemap(in, level);
+        level.LevelID = level_block.LevelID;
+        level.WorldID = level_block.WorldID;
+        ReadLevelBlock<TArchive>(in, level_block.Block, level);
         levels.push_back(std::move(level));
     }
 }
 
-bool UncompressUW2Block(const std::vector<uint8_t> &in_data, std::vector<uint8_t> &out_data)
+// Reads archive header from the stream, and classifies all of its blocks
+template <typename TArchive>
+static void ReadArchiveDirectory(Stream &in, std::vector<ArchiveBlockInfo> &arc_blocks)
 {
-    /*
-       A compressed block always starts with an Int32 value that is to be ignored.
-       If a block is actually compressed, it can be divided into subblocks.
-       Each compressed subblock starts with an Int8 number; the bits from LSB to
-       MSB describe if the following byte is just transferred to the target buffer
-       (bit set) or if we have a copy record (bit cleared). After 8 bytes or copy
-       record, the next subblock begins with an Int8 again.
-
-       The copy record starts with two Int8's:
-       0000   Int8   0..7: position, bits 0..7
-       0001   Int8   0..3: copy count
-                     4..7: position, bits 8..11
-
-       The copy count is 4 bits long and an offset of 3 is added to it. The
-       position has 12 bits (accessing the last 4k bytes) and an offset of 18 is
-       added. The sign bit is bit 11 and should be treated appropriate. As the
-       position field refers to a position in the current 4k segment, pointers
-       have to be adjusted, too. Then "copy count" bytes are copied from the
-       relative "position" to the current one.
-
-       Also used this for a reference (could not understand "copy record part"):
-       https://github.com/vividos/UnderworldAdventures/blob/main/uwadv/source/base/Uw2decode.cpp
-    */
+    std::vector<DataBlockInfo> blocks;
+    ReadBlockDirectory<TArchive>(in, blocks);
 
-    const uint8_t *src = &in_data.front();
-    const uint8_t *src_end = src + in_data.size();
-    out_data.reserve(in_data.size());
-
-    src += sizeof(int32_t); // unused?
-    // The decompression loop
-    while (src < src_end)
+    arc_blocks.resize(blocks.size());
+    for (size_t i = 0; i < blocks.size(); ++i)
     {
-        uint8_t buf_bits = *(src++);
-        for (int b = 0; b < 8; ++b)
+        const DataBlockInfo &block = blocks[i];
+        ArchiveBlockInfo &arc_block = arc_blocks[i];
+        arc_block.Block = block;
+        const uint16_t group = static_cast<uint16_t>(i / TArchive::BlockGroupSize);
+        const uint16_t in_group = static_cast<uint16_t>(i % TArchive::BlockGroupSize);
+        if (TArchive::LevelsPerWorld > 0)
         {
-            if (buf_bits & (1 << b))
-            {
-                // Direct copy byte
-                out_data.push_back(*(src++));
-            }
-            else
-            {
-                // Copy "record": this means copy previously written *uncompressed* data
-                // read 2 int32 with packed data and expand them into position and count
-                int32_t i1 = *(src++);
-                int32_t i2 = *(src++);
-                int32_t position = i1 | ((i2 & 0xF0) << 4);
-                // correct for sign bit
-                if (position & 0x800)
-                    position |= 0xFFFFF000;
-                uint8_t count = (i2 & 0x0F);
-                // add magic hardcoded offsets
-                position += 18;
-                count += 3;
-
-                assert(position < 0 || static_cast<uint32_t>(position) < out_data.size());
-                // adjust pos to current 4k segment
-                while (position < 0 ||
-                       (out_data.size() >= 4096) && (static_cast<uint32_t>(position) < (out_data.size() - 4096)))
-                    position += 4096;
-                // do the copying
-                while (count--)
-                    out_data.push_back(out_data[position++]);
-            }
+            arc_block.LevelID = (in_group % TArchive::LevelsPerWorld) + 1;
+            arc_block.WorldID = (in_group / TArchive::LevelsPerWorld) + 1;
         }
+        else
+        {
+            arc_block.LevelID = in_group + 1;
+        }
+
+        if (block.Offset == 0 || block.Size == 0)
+            arc_block.Kind = kBlockUnused;
+        else
+            arc_block.Kind = TArchive::GetGroupKind(group);
+        // Levels found by size must match it
+        if (TArchive::FindLevelsBySize && arc_block.Kind == kBlockLevel &&
+            block.Size != TArchive::LevelBlockSize)
+            arc_block.Kind = kBlockUnknown;
     }
+}
+
+// Reads archive header and finds level blocks, for the game described by
+// the TArchive traits
+template <typename TArchive>
+static void ReadLevelDirectory(const uint8_t *header, size_t header_size, soff_t archive_len,
+                               std::vector<LevelBlockInfo> &level_blocks)
+{
+    BinaryReader in(header, header_size);
+    std::vector<DataBlockInfo> blocks;
+    ReadBlockDirectory<TArchive>(in, archive_len, blocks);
+    FindLevelBlocks<TArchive>(blocks, level_blocks);
+}
+
+bool DetectGameType(const uint8_t *header, size_t header_size, soff_t archive_len, GameType &game)
+{
+    // UW2 goes first, as it has a stricter header
+    if (MatchArchiveHeader<UW2ArchiveTraits>(header, header_size, archive_len))
+        game = kGameUW2;
+    else if (MatchArchiveHeader<UW1ArchiveTraits>(header, header_size, archive_len))
+        game = kGameUW1;
+    else
+        return false;
     return true;
 }
 
-void ReadLevelsUW2(Stream &in, std::vector<LevelData> &levels)
+bool DetectGameType(Stream &in, GameType &game)
 {
-    levels.clear();
+    in.Seek(0, kSeekBegin);
+    std::vector<uint8_t> header(sizeof(int16_t));
+    if (in.Read(header.data(), header.size()) < header.size())
+        return false;
+    const uint16_t num_blocks = header[0] | (header[1] << 8);
+    const size_t header_size = GetArchiveHeaderSize(kGameUnknown, num_blocks);
+    header.resize(header_size);
+    header.resize(sizeof(int16_t) + in.Read(&header[sizeof(int16_t)], header_size - sizeof(int16_t)));
+    return DetectGameType(header.data(), header.size(), in.GetLength(), game);
+}
 
-    uint16_t num_blocks = in.ReadInt16LE();
-    in.ReadInt32LE(); // skip unknown
-    std::vector<DataBlockInfo> blocks(num_blocks);
-    for (uint16_t i = 0; i < num_blocks; ++i)
+void ReadLevels(Stream &in, GameType game, std::vector<LevelData> &levels)
+{
+    if (game == kGameUnknown)
+        DetectGameType(in, game);
+    switch (game)
     {
-        blocks[i].Index = i;
-        blocks[i].Offset = in.ReadInt32LE();
+    case kGameUW1: ReadLevels<UW1ArchiveTraits>(in, levels); break;
+    case kGameUW2: ReadLevels<UW2ArchiveTraits>(in, levels); break;
+    default: levels.clear(); break;
     }
-    for (uint16_t i = 0; i < num_blocks; ++i)
+}
+
+void ReadArchiveDirectory(Stream &in, GameType game, std::vector<ArchiveBlockInfo> &blocks)
+{
+    if (game == kGameUnknown)
+        DetectGameType(in, game);
+    switch (game)
     {
-        uint32_t flags = in.ReadInt32LE();
-        blocks[i].IsCompressed = flags & 0x2;
-        blocks[i].HasAvailSpace = flags & 0x4;
+    case kGameUW1: ReadArchiveDirectory<UW1ArchiveTraits>(in, blocks); break;
+    case kGameUW2: ReadArchiveDirectory<UW2ArchiveTraits>(in, blocks); break;
+    default: blocks.clear(); break;
     }
-    for (uint16_t i = 0; i < num_blocks; ++i)
+}
+
+size_t GetArchiveHeaderSize(GameType game, uint16_t num_blocks)
+{
+    switch (game)
     {
-        blocks[i].Size = in.ReadInt32LE();
+    case kGameUW1: return GetHeaderSize<UW1ArchiveTraits>(num_blocks);
+    case kGameUW2: return GetHeaderSize<UW2ArchiveTraits>(num_blocks);
+    default: return std::max(GetHeaderSize<UW1ArchiveTraits>(num_blocks),
+                             GetHeaderSize<UW2ArchiveTraits>(num_blocks));
     }
-    for (uint16_t i = 0; i < num_blocks; ++i)
+}
+
+void ReadLevelDirectory(Stream &in, GameType game, std::vector<LevelBlockInfo> &level_blocks)
+{
+    if (game == kGameUnknown)
+        DetectGameType(in, game);
+    switch (game)
     {
-        blocks[i].AvailSpace = in.ReadInt32LE();
+    case kGameUW1: ReadLevelDirectory<UW1ArchiveTraits>(in, level_blocks); break;
+    case kGameUW2: ReadLevelDirectory<UW2ArchiveTraits>(in, level_blocks); break;
+    default: level_blocks.clear(); break;
     }
+}
 
-    /*
-        Ultima Underworld 2 has 320 (0x0140) entries (80 levels x 4 blocks). These
-        can be split into 4 sets of 80 entries each:
+void WriteBlockDirectory(Stream &out, GameType game, const std::vector<DataBlockInfo> &blocks)
+{
+    switch (game)
+    {
+    case kGameUW1: WriteBlockDirectory<UW1ArchiveTraits>(out, blocks); break;
+    case kGameUW2: WriteBlockDirectory<UW2ArchiveTraits>(out, blocks); break;
+    default: break;
+    }
+}
 
-           0.. 79  level maps
-          80..159  texture mappings
-         160..239  automap infos
-         240..319  map notes
-    */
-    uint16_t blk_index = 0;
-    for (uint16_t world_id = 0; world_id < 10; ++world_id)
+void ReadLevelDirectory(const uint8_t *header, size_t header_size, soff_t archive_len, GameType game,
+                        std::vector<LevelBlockInfo> &level_blocks)
+{
+    if (game == kGameUnknown)
+        DetectGameType(header, header_size, archive_len, game);
+    switch (game)
     {
-        for (uint16_t level_id = 0; level_id < 8; ++level_id)
-        {
-            const auto &block = blocks[blk_index++];
-            if (block.Offset == 0 || block.Size == 0)
-                continue; // unused
+    case kGameUW1: ReadLevelDirectory<UW1ArchiveTraits>(header, header_size, archive_len, level_blocks); break;
+    case kGameUW2: ReadLevelDirectory<UW2ArchiveTraits>(header, header_size, archive_len, level_blocks); break;
+    default: level_blocks.clear(); break;
+    }
+}
 
-            LevelData level;
-            level.LevelID = level_id + 1;
-            level.WorldID = world_id + 1;
+void DecodeLevelBlock(const uint8_t *data, size_t size, const DataBlockInfo &block, LevelData &level)
+{
+    DecodeLevelBlock<UW2ArchiveTraits>(data, size, block, level);
+}
 
-            in.Seek(block.Offset, kSeekBegin);
-            if (block.IsCompressed)
-            {
-                std::vector<uint8_t> in_data(block.Size);
-                in.Read(&in_data.front(), block.Size);
-                std::vector<uint8_t> out_data;
-                if (UncompressUW2Block(in_data, out_data))
-                {
-                    Stream mems(std::make_unique<VectorStream>(out_data, kStream_Read));
-                    ReadLevelTilemap(mems, level);
-                }
-            }
-            else
-            {
-                ReadLevelTilemap(in, level);
-            }
+uint32_t GetBlockFingerprint(const uint8_t *data, size_t size)
+{
+    return Crc32C(data, size);
+}
 
-            levels.push_back(std::move(level));
-        }
+bool ReadBlockFingerprint(Stream &in, const DataBlockInfo &block, uint32_t &fingerprint)
+{
+    if (!in.Seek(block.Offset, kSeekBegin))
+        return false;
+    // The data is read in pieces, the fingerprint is computed as it comes
+    uint8_t buf[16 * 1024];
+    uint32_t crc = 0u;
+    for (size_t left = block.Size; left > 0;)
+    {
+        const size_t n = std::min(left, sizeof(buf));
+        if (in.Read(buf, n) != n)
+            return false;
+        crc = Crc32C(buf, n, crc);
+        left -= n;
     }
+    fingerprint = crc;
+    return true;
 }
@@ -11,6 +11,7 @@
 #define UWSAV__SAV_DATA_H__
 
 #include <stdint.h>
+#include <functional>
 #include <vector>
 #include "utils/stream.h"
 
@@ -32,6 +33,10 @@ enum TileType
 struct TileData
 {
     TileType Type = kTileSolid;
+    uint8_t FloorHeight = 0u;
+    uint8_t FloorTexture = 0u; // index into texture mapping
+    uint8_t WallTexture = 0u; // index into texture mapping
+    bool NoMagic = false; // no magic is allowed in this tile
     bool IsDoor = false;
     uint16_t FirstObjLink = 0u; // ref to obj list
 };
@@ -40,12 +45,65 @@ struct ObjectData
 {
     uint16_t ItemID = 0u; // type of item, defined by game
     uint16_t Flags = 0u;
+    bool IsEnchanted = false;
+    bool DoorDir = false;
+    bool IsInvisible = false;
+    bool IsQuantity = false; // special field is quantity or property, not a link
+    uint8_t XPos = 0u; // position within a tile (0-7)
+    uint8_t YPos = 0u; // position within a tile (0-7)
+    uint8_t ZPos = 0u; // height (0-127)
+    uint8_t Heading = 0u; // direction, in 45 degree steps
+    uint8_t Quality = 0u;
+    uint8_t Owner = 0u; // owner or special
     uint16_t NextObjLink = 0u; // ref to obj list
     uint16_t Quantity = 1u;
     uint16_t SpecialLink = 0u; // link to npc's or container's inventory
     uint16_t SpecialProperty = 0u; // ?
 };
 
+// NPC attitude towards the player
+enum NpcAttitude
+{
+    kNpcHostile  = 0,
+    kNpcUpset    = 1,
+    kNpcMellow   = 2,
+    kNpcFriendly = 3
+};
+
+// Extended data of a mobile object, which is used by NPCs
+struct NpcData
+{
+    uint8_t HP = 0u;
+    uint8_t Goal = 0u; // current goal (wander, attack, follow, etc)
+    uint8_t GoalTarget = 0u; // goal target, e.g. the one to attack or follow
+    uint8_t Level = 0u; // experience level
+    bool TalkedTo = false; // player has talked to this NPC
+    NpcAttitude Attitude = kNpcHostile;
+    uint8_t XHome = 0u; // home tile
+    uint8_t YHome = 0u;
+    uint8_t Hunger = 0u;
+    uint8_t WhoAmI = 0u; // conversation slot
+};
+
+// NPC data of the levels stored as columns, one row per NPC, for bulk queries
+struct NpcColumns
+{
+    std::vector<uint8_t> WorldID;
+    std::vector<uint8_t> LevelID;
+    std::vector<uint16_t> ObjIndex; // index in the master object list
+    std::vector<uint16_t> ItemID;
+    std::vector<uint8_t> HP;
+    std::vector<uint8_t> Goal;
+    std::vector<uint8_t> GoalTarget;
+    std::vector<uint8_t> Level;
+    std::vector<NpcAttitude> Attitude;
+    std::vector<uint8_t> XHome;
+    std::vector<uint8_t> YHome;
+    std::vector<uint8_t> WhoAmI;
+
+    size_t GetCount() const { return ObjIndex.size(); }
+};
+
 // General Level data
 /*
     Each underworld level consists of a 64x64 tile map.
@@ -55,7 +113,14 @@ struct ObjectData
     Then there's a master object list, which has a fixed limit of 1024 slots,
     (each of which may be filled or empty), for 256 mobile objects and
     768 static objects.
+
+    The free object slots are listed in the free lists, separately for the
+    mobile and static objects.
+
+    Mobile objects have extended data, which is kept as raw bytes, and is
+    decoded on demand with GetNpcData, as most uses do not need it.
 */
+
 struct LevelData
 {
     static const uint16_t Width = 64u;
@@ -63,17 +128,137 @@ struct LevelData
     static const uint16_t MaxObjects = 1024u;
     static const uint16_t MaxMobiles = 256u;
     static const uint16_t MaxStatic = 768u;
+    static const uint16_t MobileExtraSize = 19u; // size of the mobile extended data
 
     uint8_t LevelID = 0u;
     uint8_t WorldID = 0u; // UW2
 
     std::vector<TileData> tiles;
     std::vector<ObjectData> objs;
+    std::vector<uint8_t> mobile_extra; // raw extended data of mobile objects
+    std::vector<uint16_t> free_mobiles; // free mobile object slots
+    std::vector<uint16_t> free_statics; // free static object slots
+    bool HasFreeLists = false; // the free lists were present in data
+
+    // Decodes extended data of the mobile object
+    NpcData GetNpcData(uint16_t obj_index) const;
+};
+
+
+enum GameType
+{
+    kGameUnknown,   // not known, detect by the archive header
+    kGameUW1,
+    kGameUW2
 };
 
+// General file block info
+/*
+    The file is a container for several differently-sized blocks that contain
+    different infos of the level maps. Some blocks may be unused, e.g. automap
+    blocks.
+
+    The file header looks like this:
+
+    0000   Int16   number of blocks in file
+    0002   Int32   file offset to block 0
+    0006   Int32   file offset to block 1
+    ...            etc.
+
+    UW2 has additional tables in the header, see uwsav_data.cpp for details.
+*/
+struct DataBlockInfo
+{
+    uint32_t Index = 0u;
+    uint32_t Offset = 0u;
+    bool     IsCompressed = false; // UW2
+    bool     HasAvailSpace = false; // UW2
+    uint32_t Flags = 0u; // UW2, raw block flags
+    uint32_t Size = 0u;
+    uint32_t AvailSpace = 0u; // UW2
+};
+
+// Level tilemap block location in the archive
+struct LevelBlockInfo
+{
+    DataBlockInfo Block;
+    uint8_t LevelID = 0u;
+    uint8_t WorldID = 0u; // UW2
+};
+
+// Kind of the archive block
+enum BlockKind
+{
+    kBlockUnused,       // empty entry
+    kBlockLevel,        // level tilemap and master object list
+    kBlockAnimOverlay,  // object animation overlays (UW1)
+    kBlockTextureMap,   // texture mapping
+    kBlockAutomap,      // automap info
+    kBlockMapNotes,     // automap notes
+    kBlockUnknown       // block does not match its expected kind, or its group has none
+};
+
+// Archive block location and kind
+struct ArchiveBlockInfo
+{
+    DataBlockInfo Block;
+    BlockKind Kind = kBlockUnused;
+    uint8_t LevelID = 0u; // level this block belongs to
+    uint8_t WorldID = 0u; // UW2
+    uint32_t Fingerprint = 0u; // see GetBlockFingerprint; only set when requested
+};
+
+
+// Reads LEVEL.ARK file, fills in LevelData array.
+// All the functions below that take GameType detect the game by the archive
+// header when it is kGameUnknown, and read nothing if it was not detected.
+void ReadLevels(Stream &in, GameType game, std::vector<LevelData> &levels);
+
+// Tells if the item is a NPC
+inline bool IsNpcItem(uint16_t item_id) { return item_id >= 0x0040 && item_id <= 0x007f; }
+// Tells if the item is a container
+inline bool IsContainerItem(uint16_t item_id) { return item_id >= 0x0080 && item_id <= 0x008f; }
+// Decodes data of all NPCs found in the level, and appends it to the columns;
+// the mobile slots found in the free list hold stale data, and are skipped
+void AppendNpcColumns(const LevelData &level, NpcColumns &npcs);
+
+// Level callback, receives each level as it is read, see ForEachLevelPipelined
+typedef std::function<void(const LevelData &level)> LevelCallback;
 
-// Reads LEVEL.ARK file, fills in LevelData array
-void ReadLevelsUW1(Stream &in, std::vector<LevelData> &levels);
-void ReadLevelsUW2(Stream &in, std::vector<LevelData> &levels);
+// Returns the size of archive header, which has num_blocks entries;
+// for the unknown game returns the size enough for any of the games
+size_t GetArchiveHeaderSize(GameType game, uint16_t num_blocks);
+// Detects the game by the LEVEL.ARK header alone, without reading any blocks;
+// header should be GetArchiveHeaderSize(kGameUnknown) long, unless the file is
+// shorter. archive_len is the total length of the archive file.
+// Returns false if the header does not match any of the games.
+bool DetectGameType(const uint8_t *header, size_t header_size, soff_t archive_len, GameType &game);
+bool DetectGameType(Stream &in, GameType &game);
+// Reads LEVEL.ARK header from the memory buffer and finds level blocks in it;
+// archive_len is the total length of the archive file
+void ReadLevelDirectory(const uint8_t *header, size_t header_size, soff_t archive_len,
+                        GameType game, std::vector<LevelBlockInfo> &level_blocks);
+// Reads LEVEL.ARK header from the stream and finds level blocks in it
+void ReadLevelDirectory(Stream &in, GameType game, std::vector<LevelBlockInfo> &level_blocks);
+// Reads LEVEL.ARK header from the stream, and classifies all of its blocks
+void ReadArchiveDirectory(Stream &in, GameType game, std::vector<ArchiveBlockInfo> &blocks);
+// Writes the block tables of LEVEL.ARK header, which follow the number of
+// blocks and the game's header extras; the game must be known
+void WriteBlockDirectory(Stream &out, GameType game, const std::vector<DataBlockInfo> &blocks);
+// Reads a level from the level block data, as it is stored in the archive
+void DecodeLevelBlock(const uint8_t *data, size_t size, const DataBlockInfo &block,
+                      LevelData &level);
+// Packs the level into the uncompressed level block data, which must hold
+// the level's original block; the block is updated in place, so the data
+// not represented in LevelData is kept. Returns false if the block is
+// truncated, or the level is incomplete.
+bool PackLevelBlock(const LevelData &level, uint8_t *data, size_t size);
+// Returns the block fingerprint: CRC32C of the block data as it is stored in
+// the archive, neither decompressed nor decoded. Blocks with the same data
+// have the same fingerprint, which tells if the block has changed.
+uint32_t GetBlockFingerprint(const uint8_t *data, size_t size);
+// Reads the block data from the archive and computes its fingerprint;
+// returns false if the block could not be read in full
+bool ReadBlockFingerprint(Stream &in, const DataBlockInfo &block, uint32_t &fingerprint);
 
 #endif // UWSAV__SAV_DATA_H__
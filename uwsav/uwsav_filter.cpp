@@ -0,0 +1,469 @@
+#include "uwsav_filter.h"
+#include <algorithm>
+#include <ctype.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include "uwsav_slots.h"
+
+namespace
+{
+
+struct FieldName
+{
+    const char *Name;
+    ObjectFilter::Field Fld;
+};
+
+// Fields compared with numbers
+const FieldName NumberFields[] =
+{
+    { "item", ObjectFilter::kFieldItem },
+    { "index", ObjectFilter::kFieldIndex },
+    { "quantity", ObjectFilter::kFieldQuantity },
+    { "quality", ObjectFilter::kFieldQuality },
+    { "owner", ObjectFilter::kFieldOwner },
+    { "flags", ObjectFilter::kFieldFlags },
+    { "heading", ObjectFilter::kFieldHeading },
+    { "x", ObjectFilter::kFieldX },
+    { "y", ObjectFilter::kFieldY },
+    { "z", ObjectFilter::kFieldZ },
+    { "level", ObjectFilter::kFieldLevel },
+    { "world", ObjectFilter::kFieldWorld }
+};
+
+// Fields used as predicates on their own
+const FieldName BoolFields[] =
+{
+    { "npc", ObjectFilter::kFieldIsNpc },
+    { "container", ObjectFilter::kFieldIsContainer },
+    { "enchanted", ObjectFilter::kFieldIsEnchanted },
+    { "invisible", ObjectFilter::kFieldIsInvisible }
+};
+
+enum TokenType
+{
+    kTokenEnd,
+    kTokenWord,
+    kTokenNumber,
+    kTokenCompare,
+    kTokenRange,    // ".."
+    kTokenOpen,     // "("
+    kTokenClose,    // ")"
+    kTokenInvalid
+};
+
+struct Token
+{
+    TokenType Type = kTokenEnd;
+    std::string Text;
+    int32_t Number = 0;
+    size_t Pos = 0u; // position in the expression, for error messages
+};
+
+// Recursive descent parser, which emits the instructions in postfix order
+class FilterCompiler
+{
+public:
+    FilterCompiler(const std::string &expr, std::vector<ObjectFilter::Instruction> &program)
+        : _expr(expr), _program(program) {}
+
+    bool Compile(std::string &error)
+    {
+        Next();
+        if (!ParseOr())
+        {
+            error = _error;
+            return false;
+        }
+        if (_token.Type != kTokenEnd)
+        {
+            error = Error("unexpected text");
+            return false;
+        }
+        return true;
+    }
+
+private:
+    void Next()
+    {
+        while (_pos < _expr.size() && isspace(static_cast<unsigned char>(_expr[_pos])))
+            ++_pos;
+        _token = Token();
+        _token.Pos = _pos;
+        if (_pos >= _expr.size())
+            return;
+
+        const char c = _expr[_pos];
+        if (isalpha(static_cast<unsigned char>(c)) || c == '_')
+        {
+            const size_t start = _pos;
+            while (_pos < _expr.size() && (isalnum(static_cast<unsigned char>(_expr[_pos])) || _expr[_pos] == '_'))
+                ++_pos;
+            _token.Type = kTokenWord;
+            _token.Text = _expr.substr(start, _pos - start);
+        }
+        else if (isdigit(static_cast<unsigned char>(c)))
+        {
+            // Hexadecimal with 0x prefix, decimal otherwise (not octal)
+            const char *start = _expr.c_str() + _pos;
+            const bool is_hex = c == '0' && (start[1] == 'x' || start[1] == 'X');
+            char *end;
+            const unsigned long value = strtoul(start, &end, is_hex ? 16 : 10);
+            _pos += end - start;
+            _token.Type = (value <= static_cast<unsigned long>(INT32_MAX)) ? kTokenNumber : kTokenInvalid;
+            _token.Number = static_cast<int32_t>(value);
+        }
+        else if (_expr.compare(_pos, 2, "..") == 0)
+        {
+            _pos += 2;
+            _token.Type = kTokenRange;
+        }
+        else if (c == '(' || c == ')')
+        {
+            ++_pos;
+            _token.Type = (c == '(') ? kTokenOpen : kTokenClose;
+        }
+        else if (c == '=' || c == '!' || c == '<' || c == '>')
+        {
+            const size_t len = (_pos + 1 < _expr.size() && _expr[_pos + 1] == '=') ? 2u : 1u;
+            _token.Text = _expr.substr(_pos, len);
+            _pos += len;
+            _token.Type = (_token.Text != "!") ? kTokenCompare : kTokenInvalid;
+        }
+        else
+        {
+            _token.Type = kTokenInvalid;
+        }
+    }
+
+    bool IsWord(const char *word) const { return _token.Type == kTokenWord && _token.Text == word; }
+
+    std::string Error(const char *what) const
+    {
+        char buf[128];
+        snprintf(buf, sizeof(buf), "%s at position %d", what, static_cast<int>(_token.Pos) + 1);
+        return buf;
+    }
+
+    bool Fail(const char *what)
+    {
+        _error = Error(what);
+        return false;
+    }
+
+    void Emit(ObjectFilter::OpCode op, ObjectFilter::Field fld = ObjectFilter::kFieldItem,
+              int32_t lo = 0, int32_t hi = 0)
+    {
+        ObjectFilter::Instruction instr;
+        instr.Op = op;
+        instr.Fld = fld;
+        instr.Lo = lo;
+        instr.Hi = hi;
+        _program.push_back(instr);
+    }
+
+    bool ParseOr()
+    {
+        if (!ParseAnd())
+            return false;
+        while (IsWord("or"))
+        {
+            Next();
+            if (!ParseAnd())
+                return false;
+            Emit(ObjectFilter::kOpOr);
+        }
+        return true;
+    }
+
+    bool ParseAnd()
+    {
+        if (!ParseUnary())
+            return false;
+        while (IsWord("and"))
+        {
+            Next();
+            if (!ParseUnary())
+                return false;
+            Emit(ObjectFilter::kOpAnd);
+        }
+        return true;
+    }
+
+    bool ParseUnary()
+    {
+        // Limits the recursion on the deeply nested input
+        if (++_depth > ObjectFilter::MaxStackSize)
+            return Fail("expression is too deeply nested");
+        const bool result = ParseUnaryImpl();
+        --_depth;
+        return result;
+    }
+
+    bool ParseUnaryImpl()
+    {
+        if (IsWord("not"))
+        {
+            Next();
+            if (!ParseUnary())
+                return false;
+            Emit(ObjectFilter::kOpNot);
+            return true;
+        }
+        if (_token.Type == kTokenOpen)
+        {
+            Next();
+            if (!ParseOr())
+                return false;
+            if (_token.Type != kTokenClose)
+                return Fail("expected \")\"");
+            Next();
+            return true;
+        }
+        return ParsePredicate();
+    }
+
+    bool ParsePredicate()
+    {
+        if (_token.Type != kTokenWord)
+            return Fail("expected a field");
+
+        if (IsWord("inside"))
+        {
+            Next();
+            ObjectFilter::Field fld = ObjectFilter::kFieldInside;
+            if (IsWord("npc"))
+                fld = ObjectFilter::kFieldInsideNpc;
+            else if (IsWord("container"))
+                fld = ObjectFilter::kFieldInsideContainer;
+            if (fld != ObjectFilter::kFieldInside)
+                Next();
+            Emit(ObjectFilter::kOpRange, fld, 1, 1);
+            return true;
+        }
+        for (const auto &field : BoolFields)
+        {
+            if (IsWord(field.Name))
+            {
+                Next();
+                Emit(ObjectFilter::kOpRange, field.Fld, 1, 1);
+                return true;
+            }
+        }
+
+        const FieldName *field = nullptr;
+        for (const auto &f : NumberFields)
+        {
+            if (IsWord(f.Name))
+                field = &f;
+        }
+        if (!field)
+            return Fail("unknown field");
+        Next();
+
+        if (IsWord("in"))
+        {
+            Next();
+            int32_t lo, hi;
+            if (!ParseNumber(lo))
+                return false;
+            hi = lo;
+            if (_token.Type == kTokenRange)
+            {
+                Next();
+                if (!ParseNumber(hi))
+                    return false;
+            }
+            Emit(ObjectFilter::kOpRange, field->Fld, lo, hi);
+            return true;
+        }
+
+        if (_token.Type != kTokenCompare)
+            return Fail("expected a comparison");
+        const std::string cmp = _token.Text;
+        Next();
+        int32_t value;
+        if (!ParseNumber(value))
+            return false;
+        // Numbers are never negative, so the bounds below do not overflow
+        if (cmp == "==" || cmp == "=")
+            Emit(ObjectFilter::kOpRange, field->Fld, value, value);
+        else if (cmp == "!=")
+        {
+            Emit(ObjectFilter::kOpRange, field->Fld, value, value);
+            Emit(ObjectFilter::kOpNot);
+        }
+        else if (cmp == "<")
+            Emit(ObjectFilter::kOpRange, field->Fld, INT32_MIN, value - 1);
+        else if (cmp == "<=")
+            Emit(ObjectFilter::kOpRange, field->Fld, INT32_MIN, value);
+        else if (cmp == ">")
+            Emit(ObjectFilter::kOpRange, field->Fld, value + 1, INT32_MAX);
+        else // ">="
+            Emit(ObjectFilter::kOpRange, field->Fld, value, INT32_MAX);
+        return true;
+    }
+
+    bool ParseNumber(int32_t &value)
+    {
+        if (_token.Type != kTokenNumber)
+            return Fail("expected a number");
+        value = _token.Number;
+        Next();
+        return true;
+    }
+
+    const std::string &_expr;
+    std::vector<ObjectFilter::Instruction> &_program;
+    size_t _pos = 0u;
+    size_t _depth = 0u;
+    Token _token;
+    std::string _error;
+};
+
+inline int32_t GetField(ObjectFilter::Field fld, const ObjectContext &ctx, const ObjectData &obj)
+{
+    switch (fld)
+    {
+    case ObjectFilter::kFieldItem: return obj.ItemID;
+    case ObjectFilter::kFieldIndex: return ctx.ObjIndex;
+    case ObjectFilter::kFieldQuantity: return obj.Quantity;
+    case ObjectFilter::kFieldQuality: return obj.Quality;
+    case ObjectFilter::kFieldOwner: return obj.Owner;
+    case ObjectFilter::kFieldFlags: return obj.Flags;
+    case ObjectFilter::kFieldHeading: return obj.Heading;
+    case ObjectFilter::kFieldX: return ctx.TileX;
+    case ObjectFilter::kFieldY: return ctx.TileY;
+    case ObjectFilter::kFieldZ: return obj.ZPos;
+    case ObjectFilter::kFieldLevel: return ctx.Level->LevelID;
+    case ObjectFilter::kFieldWorld: return ctx.Level->WorldID;
+    case ObjectFilter::kFieldIsNpc: return IsNpcItem(obj.ItemID);
+    case ObjectFilter::kFieldIsContainer: return IsContainerItem(obj.ItemID);
+    case ObjectFilter::kFieldIsEnchanted: return obj.IsEnchanted;
+    case ObjectFilter::kFieldIsInvisible: return obj.IsInvisible;
+    case ObjectFilter::kFieldInside: return ctx.Parent != 0;
+    case ObjectFilter::kFieldInsideNpc: return ctx.InsideNpc;
+    case ObjectFilter::kFieldInsideContainer: return ctx.InsideContainer;
+    default: return 0;
+    }
+}
+
+} // namespace
+
+bool ObjectFilter::Compile(const std::string &expr, std::string &error)
+{
+    _expr = expr;
+    _program.clear();
+    FilterCompiler compiler(_expr, _program);
+    if (!compiler.Compile(error))
+    {
+        _program.clear();
+        return false;
+    }
+
+    // Test the stack depth once here, so that Match needs no checks
+    size_t depth = 0u, max_depth = 0u;
+    for (const auto &instr : _program)
+    {
+        if (instr.Op == kOpRange)
+            max_depth = std::max(max_depth, ++depth);
+        else if (instr.Op != kOpNot)
+            --depth;
+    }
+    if (max_depth > MaxStackSize)
+    {
+        _program.clear();
+        error = "expression is too deeply nested";
+        return false;
+    }
+    return true;
+}
+
+bool ObjectFilter::Match(const ObjectContext &ctx) const
+{
+    if (_program.empty())
+        return false;
+    const ObjectData &obj = ctx.Level->objs[ctx.ObjIndex];
+    bool stack[MaxStackSize];
+    size_t top = 0u;
+    for (const auto &instr : _program)
+    {
+        switch (instr.Op)
+        {
+        case kOpRange:
+        {
+            const int32_t value = GetField(instr.Fld, ctx, obj);
+            stack[top++] = value >= instr.Lo && value <= instr.Hi;
+            break;
+        }
+        case kOpNot:
+            stack[top - 1] = !stack[top - 1];
+            break;
+        case kOpAnd:
+            --top;
+            stack[top - 1] = stack[top - 1] && stack[top];
+            break;
+        case kOpOr:
+            --top;
+            stack[top - 1] = stack[top - 1] || stack[top];
+            break;
+        }
+    }
+    return stack[0];
+}
+
+void ForEachObject(const LevelData &level, const ObjectVisitor &on_object)
+{
+    const size_t obj_num = std::min<size_t>(level.objs.size(), LevelData::MaxObjects);
+    ObjectSlotSet visited;
+    std::vector<ObjectContext> chains; // chain starts to visit, with their location
+    std::vector<ObjectContext> containers;
+    for (uint16_t y = 0; y < level.Height; ++y)
+    {
+        for (uint16_t x = 0; x < level.Width; ++x)
+        {
+            ObjectContext tile_ctx;
+            tile_ctx.Level = &level;
+            tile_ctx.ObjIndex = level.tiles[y * level.Width + x].FirstObjLink;
+            tile_ctx.TileX = static_cast<uint8_t>(x);
+            tile_ctx.TileY = static_cast<uint8_t>(y);
+            chains.push_back(tile_ctx);
+            while (!chains.empty())
+            {
+                ObjectContext ctx = chains.back();
+                chains.pop_back();
+                // Like the object list, walk the chain first, and then the
+                // contents of its NPCs and containers, in the chain order
+                containers.clear();
+                for (; ctx.ObjIndex > 0 && ctx.ObjIndex < obj_num && !visited.test(ctx.ObjIndex);
+                     ctx.ObjIndex = level.objs[ctx.ObjIndex].NextObjLink)
+                {
+                    visited.set(ctx.ObjIndex);
+                    on_object(ctx);
+                    const ObjectData &obj = level.objs[ctx.ObjIndex];
+                    const bool is_npc = IsNpcItem(obj.ItemID);
+                    if ((is_npc || IsContainerItem(obj.ItemID)) && obj.SpecialLink > 0)
+                    {
+                        ObjectContext inner = ctx;
+                        inner.ObjIndex = obj.SpecialLink;
+                        inner.Parent = ctx.ObjIndex;
+                        inner.InsideNpc |= is_npc;
+                        inner.InsideContainer |= !is_npc;
+                        containers.push_back(inner);
+                    }
+                }
+                chains.insert(chains.end(), containers.rbegin(), containers.rend());
+            }
+        }
+    }
+}
+
+void FindObjects(const LevelData &level, const ObjectFilter &filter, std::vector<ObjectContext> &result)
+{
+    ForEachObject(level, [&filter, &result](const ObjectContext &ctx)
+    {
+        if (filter.Match(ctx))
+            result.push_back(ctx);
+    });
+}
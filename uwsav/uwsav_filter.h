@@ -0,0 +1,119 @@
+//=============================================================================
+//
+// Object filter expressions.
+//
+// The expression is parsed once, and compiled into a flat program in the
+// postfix order, which is then run for each object without any parsing or
+// allocations. Comparisons are all compiled into the range tests, so the
+// program has only a few kinds of instructions.
+//
+// Expression syntax:
+//
+//   expr       := and_expr { "or" and_expr }
+//   and_expr   := unary { "and" unary }
+//   unary      := "not" unary | "(" expr ")" | predicate
+//   predicate  := field cmp number
+//               | field "in" number [ ".." number ]
+//               | "inside" [ "npc" | "container" ]
+//               | "npc" | "container" | "enchanted" | "invisible"
+//   cmp        := "==" | "=" | "!=" | "<" | "<=" | ">" | ">="
+//
+// Fields are: item, index, quantity, quality, owner, flags, heading, x, y
+// (tile position), z, level, world. Numbers are decimal, or hexadecimal
+// with the 0x prefix. "inside" tells that the object is among the contents
+// of an NPC or a container, at any depth.
+//
+// Example: item in 0x080..0x08f and quantity > 10 and level in 3..5 and inside npc
+//
+//=============================================================================
+#ifndef UWSAV__FILTER_H__
+#define UWSAV__FILTER_H__
+
+#include <functional>
+#include <string>
+#include <vector>
+#include "uwsav/uwsav_data.h"
+
+// Object found on the level, with its location
+struct ObjectContext
+{
+    const LevelData *Level = nullptr;
+    uint16_t ObjIndex = 0u; // index in the master object list
+    uint8_t TileX = 0u; // tile where the object, or its outermost container lies
+    uint8_t TileY = 0u;
+    uint16_t Parent = 0u; // NPC or container holding the object, 0 if on the map
+    bool InsideNpc = false; // object is held by a NPC, at any depth
+    bool InsideContainer = false; // object is held by a container, at any depth
+};
+
+class ObjectFilter
+{
+public:
+    // Compiles the expression; on failure sets the error message,
+    // and the filter matches nothing
+    bool Compile(const std::string &expr, std::string &error);
+
+    const std::string &GetExpression() const { return _expr; }
+    // Tells if the object matches the filter
+    bool Match(const ObjectContext &ctx) const;
+
+    // Deepest expression which may be compiled
+    static const size_t MaxStackSize = 64u;
+
+    enum Field
+    {
+        kFieldItem,
+        kFieldIndex,
+        kFieldQuantity,
+        kFieldQuality,
+        kFieldOwner,
+        kFieldFlags,
+        kFieldHeading,
+        kFieldX,
+        kFieldY,
+        kFieldZ,
+        kFieldLevel,
+        kFieldWorld,
+        // Boolean fields, which give 0 or 1
+        kFieldIsNpc,
+        kFieldIsContainer,
+        kFieldIsEnchanted,
+        kFieldIsInvisible,
+        kFieldInside,
+        kFieldInsideNpc,
+        kFieldInsideContainer
+    };
+
+    enum OpCode
+    {
+        kOpRange, // push: field value is in [Lo, Hi]
+        kOpNot,   // pop one, push negation
+        kOpAnd,   // pop two, push conjunction
+        kOpOr     // pop two, push disjunction
+    };
+
+    struct Instruction
+    {
+        OpCode Op = kOpRange;
+        Field Fld = kFieldItem;
+        int32_t Lo = 0;
+        int32_t Hi = 0;
+    };
+
+private:
+    std::string _expr;
+    std::vector<Instruction> _program;
+};
+
+// Object callback, receives each object with its location
+typedef std::function<void(const ObjectContext &ctx)> ObjectVisitor;
+// Walks the objects lying on the level's tiles and their contents, in the
+// same order as they are printed by the object list, and passes each one
+// to the callback. Each object is visited once, even if the broken data
+// links it several times.
+void ForEachObject(const LevelData &level, const ObjectVisitor &on_object);
+// Walks the objects like ForEachObject, and appends those matching the
+// filter to the result
+void FindObjects(const LevelData &level, const ObjectFilter &filter, std::vector<ObjectContext> &result);
+
+#endif // UWSAV__FILTER_H__
@@ -0,0 +1,103 @@
+#include "uwsav_histogram.h"
+#include <algorithm>
+#include "uwsav_filter.h"
+
+// Number of partial histograms used when counting
+static const size_t CountLanes = 4u;
+
+// Counts item ids into the bins. Consecutive ids go to the different
+// partial histograms, so that the runs of the same id, which are common,
+// do not wait for each other's increments.
+static void CountItems(const std::vector<uint16_t> &ids, uint64_t *bins)
+{
+    uint32_t lanes[CountLanes][ItemHistogram::BinCount] = {};
+    const size_t count = ids.size();
+    const uint16_t *id = ids.data();
+    size_t i = 0;
+    for (; i + CountLanes <= count; i += CountLanes)
+    {
+        lanes[0][id[i] & 0x1FF]++;
+        lanes[1][id[i + 1] & 0x1FF]++;
+        lanes[2][id[i + 2] & 0x1FF]++;
+        lanes[3][id[i + 3] & 0x1FF]++;
+    }
+    for (; i < count; ++i)
+        lanes[0][id[i] & 0x1FF]++;
+    for (size_t bin = 0; bin < ItemHistogram::BinCount; ++bin)
+        bins[bin] += lanes[0][bin] + lanes[1][bin] + lanes[2][bin] + lanes[3][bin];
+}
+
+void ItemHistogram::Clear()
+{
+    std::fill(OnMap, OnMap + BinCount, 0u);
+    std::fill(InContainer, InContainer + BinCount, 0u);
+    std::fill(InNpc, InNpc + BinCount, 0u);
+    std::fill(Quantity, Quantity + BinCount, 0u);
+    LevelCount = 0u;
+}
+
+void ItemHistogram::AddLevel(const LevelData &level)
+{
+    // Objects are sorted into the ItemID columns first, which are then
+    // counted in one go each
+    std::vector<uint16_t> on_map, in_container, in_npc;
+    on_map.reserve(LevelData::MaxObjects);
+    ForEachObject(level, [&](const ObjectContext &ctx)
+    {
+        const ObjectData &obj = level.objs[ctx.ObjIndex];
+        if (ctx.InsideNpc)
+            in_npc.push_back(obj.ItemID);
+        else if (ctx.InsideContainer)
+            in_container.push_back(obj.ItemID);
+        else
+            on_map.push_back(obj.ItemID);
+        Quantity[obj.ItemID & 0x1FF] += obj.Quantity;
+    });
+    CountItems(on_map, OnMap);
+    CountItems(in_container, InContainer);
+    CountItems(in_npc, InNpc);
+    LevelCount++;
+}
+
+void ItemHistogram::Merge(const ItemHistogram &other)
+{
+    for (size_t bin = 0; bin < BinCount; ++bin)
+    {
+        OnMap[bin] += other.OnMap[bin];
+        InContainer[bin] += other.InContainer[bin];
+        InNpc[bin] += other.InNpc[bin];
+        Quantity[bin] += other.Quantity[bin];
+    }
+    LevelCount += other.LevelCount;
+}
+
+HistogramCounter::HistogramCounter(unsigned thread_count)
+    : _pool(thread_count)
+{
+    _histograms.resize(_pool.GetThreadCount());
+    for (size_t i = 0; i < _histograms.size(); ++i)
+        _freeHistograms.push_back(i);
+}
+
+void HistogramCounter::AddLevel(const SharedLevel &level)
+{
+    _pool.Post([this, level]()
+    {
+        size_t slot;
+        {
+            std::lock_guard<std::mutex> lk(_mutex);
+            slot = _freeHistograms.back();
+            _freeHistograms.pop_back();
+        }
+        _histograms[slot].AddLevel(*level);
+        std::lock_guard<std::mutex> lk(_mutex);
+        _freeHistograms.push_back(slot);
+    });
+}
+
+void HistogramCounter::GetResult(ItemHistogram &hist)
+{
+    _pool.Wait();
+    for (const auto &h : _histograms)
+        hist.Merge(h);
+}
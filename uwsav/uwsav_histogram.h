@@ -0,0 +1,67 @@
+//=============================================================================
+//
+// ItemID histogram over many levels.
+//
+// Objects are counted per ItemID, separately for those lying on the map,
+// those in containers, and those in NPC inventories, together with their
+// total quantity. ItemID is 9 bits, so the histogram is a set of plain
+// 512-bin arrays.
+//
+// HistogramCounter counts levels on a pool of threads: each running task
+// has its own histogram, so the counting needs no atomics or locks, and
+// the histograms are merged once at the end.
+//
+//=============================================================================
+#ifndef UWSAV__HISTOGRAM_H__
+#define UWSAV__HISTOGRAM_H__
+
+#include <mutex>
+#include <vector>
+#include "uwsav/uwsav_levelcache.h"
+#include "utils/threadpool.h"
+
+struct ItemHistogram
+{
+    static const size_t BinCount = 512u; // ItemID is 9 bits
+
+    uint64_t OnMap[BinCount];
+    uint64_t InContainer[BinCount]; // in containers, but not in NPC inventories
+    uint64_t InNpc[BinCount]; // in NPC inventories, at any depth
+    uint64_t Quantity[BinCount]; // total quantity, wherever the objects are
+    uint64_t LevelCount = 0u;
+
+    ItemHistogram() { Clear(); }
+
+    void Clear();
+    // Counts objects of the level, see ForEachObject
+    void AddLevel(const LevelData &level);
+    // Adds counts of the other histogram
+    void Merge(const ItemHistogram &other);
+
+    uint64_t GetTotal(size_t item) const { return OnMap[item] + InContainer[item] + InNpc[item]; }
+};
+
+class HistogramCounter
+{
+public:
+    // Starts the counter with the given number of threads;
+    // 0 means the number of hardware threads
+    HistogramCounter(unsigned thread_count = 0u);
+
+    // Posts the level for counting; the level is kept until it is counted
+    void AddLevel(const SharedLevel &level);
+    // Waits until all the levels are counted, and merges their counts
+    // into the result
+    void GetResult(ItemHistogram &hist);
+
+private:
+    // Histograms of the running tasks; a task takes a free one, and puts it
+    // back when done. There are as many as the threads, so one is always free.
+    std::vector<ItemHistogram> _histograms;
+    std::vector<size_t> _freeHistograms;
+    std::mutex _mutex;
+    // The pool goes last, so that it stops before the histograms are destroyed
+    ThreadPool _pool;
+};
+
+#endif // UWSAV__HISTOGRAM_H__
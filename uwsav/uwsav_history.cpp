@@ -0,0 +1,440 @@
+#include "uwsav_history.h"
+#include <algorithm>
+#include <string.h>
+#include "utils/binaryreader.h"
+#include "utils/memorystream.h"
+
+static const char PackSignature[4] = { 'U', 'W', 'H', 'P' };
+static const uint16_t PackVersion = 1u;
+static const size_t PackHeaderSize = 16u;
+// Sizes of the index entries
+static const size_t ChunkEntrySize = 20u;
+static const size_t SegmentEntrySize = 10u;
+// Block index of the header segment
+static const uint16_t HeaderSegment = 0xFFFF;
+// Longest chain of deltas; a segment is stored in full after that many,
+// which limits the number of chunks read for one segment
+static const uint32_t MaxDeltaChain = 16u;
+// Shortest run of equal bytes which is worth splitting the delta literal
+static const size_t MinDeltaCopy = 4u;
+
+//-----------------------------------------------------------------------------
+// Delta encoding
+/*
+    Delta is a sequence of varints and literal bytes:
+
+    VarInt   size of the data
+    then until the data is complete:
+    VarInt   number of bytes equal to the base, at the same position
+    VarInt   number of literal bytes
+    ...      literal bytes
+
+    VarInt is a 7-bit per byte unsigned number, low bits first; the high bit
+    of each byte tells that more bytes follow.
+*/
+//-----------------------------------------------------------------------------
+
+static void WriteVarUInt(std::vector<uint8_t> &buf, size_t val)
+{
+    for (; val >= 0x80; val >>= 7)
+        buf.push_back(static_cast<uint8_t>(val | 0x80));
+    buf.push_back(static_cast<uint8_t>(val));
+}
+
+static bool ReadVarUInt(const uint8_t *&p, const uint8_t *end, size_t &val)
+{
+    val = 0u;
+    for (unsigned shift = 0; p < end && shift < 32; shift += 7)
+    {
+        const uint8_t b = *(p++);
+        val |= static_cast<size_t>(b & 0x7F) << shift;
+        if ((b & 0x80) == 0)
+            return true;
+    }
+    return false;
+}
+
+static void EncodeDelta(const uint8_t *base, size_t base_size, const uint8_t *data, size_t size,
+                        std::vector<uint8_t> &delta)
+{
+    delta.clear();
+    WriteVarUInt(delta, size);
+    const size_t common = std::min(base_size, size);
+    for (size_t pos = 0; pos < size;)
+    {
+        size_t same_end = pos;
+        while (same_end < common && base[same_end] == data[same_end])
+            ++same_end;
+        // Literal ends at the next run of equal bytes which is long enough,
+        // or at the end of data
+        size_t diff_end = same_end;
+        while (diff_end < size)
+        {
+            if (diff_end >= common || base[diff_end] != data[diff_end])
+            {
+                ++diff_end;
+                continue;
+            }
+            size_t run_end = diff_end;
+            while (run_end < common && run_end - diff_end < MinDeltaCopy && base[run_end] == data[run_end])
+                ++run_end;
+            if (run_end - diff_end >= MinDeltaCopy || run_end == size)
+                break;
+            diff_end = run_end;
+        }
+        WriteVarUInt(delta, same_end - pos);
+        WriteVarUInt(delta, diff_end - same_end);
+        delta.insert(delta.end(), data + same_end, data + diff_end);
+        pos = diff_end;
+    }
+}
+
+static bool ApplyDelta(const std::vector<uint8_t> &base, const uint8_t *delta, size_t delta_size,
+                       std::vector<uint8_t> &data)
+{
+    const uint8_t *p = delta;
+    const uint8_t *end = delta + delta_size;
+    size_t size;
+    if (!ReadVarUInt(p, end, size))
+        return false;
+    data.resize(size);
+    for (size_t pos = 0; pos < size;)
+    {
+        size_t same, diff;
+        if (!ReadVarUInt(p, end, same) || !ReadVarUInt(p, end, diff) ||
+            same > size - pos || diff > size - pos - same || same > base.size() - std::min(pos, base.size()) ||
+            diff > static_cast<size_t>(end - p))
+            return false;
+        std::copy(base.begin() + pos, base.begin() + pos + same, data.begin() + pos);
+        pos += same;
+        std::copy(p, p + diff, data.begin() + pos);
+        pos += diff;
+        p += diff;
+    }
+    return true;
+}
+
+//-----------------------------------------------------------------------------
+// HistoryPackWriter
+//-----------------------------------------------------------------------------
+
+HistoryPackWriter::HistoryPackWriter(Stream &out, GameType game)
+    : _out(out)
+    , _game(game)
+{
+    // The header is written again when the index offset is known
+    const uint8_t header[PackHeaderSize] = {};
+    _failed = !_out || _out.Write(header, sizeof(header)) != sizeof(header);
+}
+
+bool HistoryPackWriter::AddSnapshot(Stream &archive, const std::string &name)
+{
+    if (_failed || _finished || !archive)
+        return false;
+    const soff_t length = archive.GetLength();
+    if (length <= 0 || length > INT32_MAX)
+        return false;
+    std::vector<uint8_t> data(static_cast<size_t>(length));
+    archive.Seek(0, kSeekBegin);
+    if (archive.Read(data.data(), data.size()) != data.size())
+        return false;
+
+    Stream in(std::unique_ptr<StreamBase>(new VectorStream(data)));
+    GameType game = _game;
+    if (!DetectGameType(in, game) || (_game != kGameUnknown && game != _game))
+        return false;
+    _game = game;
+    std::vector<ArchiveBlockInfo> blocks;
+    ReadArchiveDirectory(in, _game, blocks);
+    if (blocks.empty())
+        return false;
+
+    // Split the archive at the block offsets; each segment lasts until the
+    // next one, so together they cover the whole file
+    Snapshot snap;
+    snap.Name = name;
+    snap.Length = static_cast<uint32_t>(length);
+    Segment header;
+    header.Block = HeaderSegment;
+    snap.Segments.push_back(header);
+    for (const auto &block : blocks)
+    {
+        if (block.Block.Offset == 0)
+            continue;
+        Segment seg;
+        seg.Block = static_cast<uint16_t>(block.Block.Index);
+        seg.Offset = std::min(block.Block.Offset, snap.Length);
+        snap.Segments.push_back(seg);
+    }
+    std::stable_sort(snap.Segments.begin() + 1, snap.Segments.end(),
+        [](const Segment &a, const Segment &b) { return a.Offset < b.Offset; });
+
+    std::unordered_map<uint16_t, std::pair<uint32_t, std::vector<uint8_t>>> last;
+    for (size_t i = 0; i < snap.Segments.size(); ++i)
+    {
+        Segment &seg = snap.Segments[i];
+        const uint32_t seg_end = (i + 1 < snap.Segments.size()) ? snap.Segments[i + 1].Offset : snap.Length;
+        const uint8_t *seg_data = data.data() + seg.Offset;
+        const size_t seg_size = seg_end - seg.Offset;
+        seg.Chunk = StoreSegment(seg.Block, seg_data, seg_size);
+        last[seg.Block] = std::make_pair(seg.Chunk, std::vector<uint8_t>(seg_data, seg_data + seg_size));
+    }
+    if (_failed)
+        return false;
+    _last.swap(last);
+    _snapshots.push_back(std::move(snap));
+    _sourceSize += length;
+    return true;
+}
+
+uint32_t HistoryPackWriter::StoreSegment(uint16_t block, const uint8_t *data, size_t size)
+{
+    Chunk chunk;
+    chunk.Size = static_cast<uint32_t>(size);
+    const uint8_t *stored = data;
+    chunk.StoredSize = chunk.Size;
+
+    auto it = _last.find(block);
+    if (it != _last.end())
+    {
+        const uint32_t last_chunk = it->second.first;
+        const std::vector<uint8_t> &last_data = it->second.second;
+        if (last_data.size() == size && std::equal(last_data.begin(), last_data.end(), data))
+            return last_chunk;
+        if (_chunks[last_chunk].Depth < MaxDeltaChain)
+        {
+            EncodeDelta(last_data.data(), last_data.size(), data, size, _delta);
+            // Keep the delta only if it saves at least a quarter
+            if (_delta.size() < size - size / 4)
+            {
+                stored = _delta.data();
+                chunk.StoredSize = static_cast<uint32_t>(_delta.size());
+                chunk.Base = static_cast<int32_t>(last_chunk);
+                chunk.Depth = _chunks[last_chunk].Depth + 1;
+            }
+        }
+    }
+
+    chunk.Offset = _out.GetPosition();
+    if (_out.Write(stored, chunk.StoredSize) != chunk.StoredSize)
+        _failed = true;
+    _chunks.push_back(chunk);
+    return static_cast<uint32_t>(_chunks.size() - 1);
+}
+
+bool HistoryPackWriter::Finish()
+{
+    if (_failed || _finished)
+        return false;
+    _finished = true;
+    std::vector<uint8_t> index;
+    {
+        Stream out(std::unique_ptr<StreamBase>(new VectorStream(index, kStream_Write)));
+        out.WriteInt32LE(static_cast<int32_t>(_chunks.size()));
+        for (const auto &chunk : _chunks)
+        {
+            out.WriteInt64LE(chunk.Offset);
+            out.WriteInt32LE(chunk.StoredSize);
+            out.WriteInt32LE(chunk.Size);
+            out.WriteInt32LE(chunk.Base);
+        }
+        out.WriteInt32LE(static_cast<int32_t>(_snapshots.size()));
+        for (const auto &snap : _snapshots)
+        {
+            out.WriteInt32LE(snap.Length);
+            out.WriteInt16LE(static_cast<int16_t>(snap.Name.size()));
+            out.Write(snap.Name.c_str(), snap.Name.size());
+            out.WriteInt16LE(static_cast<int16_t>(snap.Segments.size()));
+            for (const auto &seg : snap.Segments)
+            {
+                out.WriteInt16LE(static_cast<int16_t>(seg.Block));
+                out.WriteInt32LE(seg.Offset);
+                out.WriteInt32LE(seg.Chunk);
+            }
+        }
+    }
+
+    const soff_t index_offset = _out.GetPosition();
+    if (_out.Write(index.data(), index.size()) != index.size() || !_out.Seek(0, kSeekBegin))
+        return false;
+    _out.Write(PackSignature, sizeof(PackSignature));
+    _out.WriteInt16LE(PackVersion);
+    _out.WriteInt16LE(static_cast<int16_t>(_game));
+    _out.WriteInt64LE(index_offset);
+    return _out.Seek(0, kSeekEnd);
+}
+
+//-----------------------------------------------------------------------------
+// HistoryPackReader
+//-----------------------------------------------------------------------------
+
+HistoryPackReader::HistoryPackReader(Stream &in)
+    : _in(in)
+{
+    _valid = ReadIndex();
+    if (!_valid)
+    {
+        _chunks.clear();
+        _snapshots.clear();
+    }
+}
+
+bool HistoryPackReader::ReadIndex()
+{
+    uint8_t header[PackHeaderSize];
+    if (!_in || !_in.Seek(0, kSeekBegin) || _in.Read(header, sizeof(header)) != sizeof(header) ||
+        memcmp(header, PackSignature, sizeof(PackSignature)) != 0)
+        return false;
+    BinaryReader hdr(header + sizeof(PackSignature), sizeof(header) - sizeof(PackSignature));
+    if (static_cast<uint16_t>(hdr.ReadInt16LE()) != PackVersion)
+        return false;
+    _game = static_cast<GameType>(hdr.ReadInt16LE());
+    const soff_t index_offset = hdr.ReadInt64LE();
+    const soff_t pack_len = _in.GetLength();
+    if ((_game != kGameUW1 && _game != kGameUW2) ||
+        index_offset < static_cast<soff_t>(PackHeaderSize) || index_offset > pack_len)
+        return false;
+
+    std::vector<uint8_t> index(static_cast<size_t>(pack_len - index_offset));
+    if (!_in.Seek(index_offset, kSeekBegin) || _in.Read(index.data(), index.size()) != index.size())
+        return false;
+    BinaryReader in(index.data(), index.size());
+
+    if (!in.Require(4))
+        return false;
+    const uint32_t num_chunks = static_cast<uint32_t>(in.ReadInt32LE());
+    if (num_chunks > in.GetRemaining() / ChunkEntrySize)
+        return false;
+    _chunks.resize(num_chunks);
+    for (uint32_t i = 0; i < num_chunks; ++i)
+    {
+        Chunk &chunk = _chunks[i];
+        chunk.Offset = in.ReadInt64LE();
+        chunk.StoredSize = static_cast<uint32_t>(in.ReadInt32LE());
+        chunk.Size = static_cast<uint32_t>(in.ReadInt32LE());
+        chunk.Base = in.ReadInt32LE();
+        // Base must precede the chunk, which rules out the loops
+        if (chunk.Offset < static_cast<soff_t>(PackHeaderSize) ||
+            chunk.Offset + chunk.StoredSize > index_offset ||
+            chunk.Base >= static_cast<int32_t>(i) || chunk.Base < -1)
+            return false;
+    }
+
+    if (!in.Require(4))
+        return false;
+    const uint32_t num_snapshots = static_cast<uint32_t>(in.ReadInt32LE());
+    if (num_snapshots > in.GetRemaining() / 8)
+        return false;
+    _snapshots.resize(num_snapshots);
+    for (auto &snap : _snapshots)
+    {
+        if (!in.Require(6))
+            return false;
+        snap.Length = static_cast<uint32_t>(in.ReadInt32LE());
+        const uint16_t name_len = static_cast<uint16_t>(in.ReadInt16LE());
+        if (!in.Require(name_len + 2u))
+            return false;
+        const char *name = reinterpret_cast<const char*>(in.ReadBytes(name_len));
+        snap.Name.assign(name, name + name_len);
+        const uint16_t num_segments = static_cast<uint16_t>(in.ReadInt16LE());
+        if (!in.Require(num_segments * SegmentEntrySize))
+            return false;
+        snap.Segments.resize(num_segments);
+        uint32_t offset = 0u;
+        for (auto &seg : snap.Segments)
+        {
+            seg.Block = static_cast<uint16_t>(in.ReadInt16LE());
+            seg.Offset = static_cast<uint32_t>(in.ReadInt32LE());
+            seg.Chunk = static_cast<uint32_t>(in.ReadInt32LE());
+            // Segments must follow each other, and cover the whole archive
+            if (seg.Offset != offset || seg.Chunk >= num_chunks ||
+                _chunks[seg.Chunk].Size > snap.Length - seg.Offset)
+                return false;
+            offset += _chunks[seg.Chunk].Size;
+        }
+        if (offset != snap.Length)
+            return false;
+    }
+    return true;
+}
+
+bool HistoryPackReader::ReadChunk(uint32_t chunk, std::vector<uint8_t> &data)
+{
+    // Collect the chain of deltas, and apply them starting from the full chunk
+    std::vector<uint32_t> chain;
+    for (int32_t c = static_cast<int32_t>(chunk); c >= 0; c = _chunks[c].Base)
+        chain.push_back(static_cast<uint32_t>(c));
+    for (auto it = chain.rbegin(); it != chain.rend(); ++it)
+    {
+        const Chunk &ch = _chunks[*it];
+        _stored.resize(ch.StoredSize);
+        if (!_in.Seek(ch.Offset, kSeekBegin) || _in.Read(_stored.data(), _stored.size()) != _stored.size())
+            return false;
+        if (ch.Base < 0)
+        {
+            data.swap(_stored);
+            continue;
+        }
+        _base.swap(data);
+        if (!ApplyDelta(_base, _stored.data(), _stored.size(), data))
+            return false;
+    }
+    return data.size() == _chunks[chunk].Size;
+}
+
+const HistoryPackReader::Segment *HistoryPackReader::FindSegment(const Snapshot &snap, uint16_t block) const
+{
+    for (const auto &seg : snap.Segments)
+    {
+        if (seg.Block == block)
+            return &seg;
+    }
+    return nullptr;
+}
+
+bool HistoryPackReader::ReadArchive(size_t snapshot, std::vector<uint8_t> &data)
+{
+    if (snapshot >= _snapshots.size())
+        return false;
+    const Snapshot &snap = _snapshots[snapshot];
+    data.clear();
+    data.reserve(snap.Length);
+    std::vector<uint8_t> seg_data;
+    for (const auto &seg : snap.Segments)
+    {
+        if (!ReadChunk(seg.Chunk, seg_data))
+            return false;
+        data.insert(data.end(), seg_data.begin(), seg_data.end());
+    }
+    return true;
+}
+
+bool HistoryPackReader::ReadLevelDirectory(size_t snapshot, std::vector<LevelBlockInfo> &level_blocks)
+{
+    level_blocks.clear();
+    if (snapshot >= _snapshots.size())
+        return false;
+    const Snapshot &snap = _snapshots[snapshot];
+    const Segment *header = FindSegment(snap, HeaderSegment);
+    std::vector<uint8_t> data;
+    if (!header || !ReadChunk(header->Chunk, data))
+        return false;
+    ::ReadLevelDirectory(data.data(), data.size(), snap.Length, _game, level_blocks);
+    return !level_blocks.empty();
+}
+
+bool HistoryPackReader::ReadLevel(size_t snapshot, size_t level, LevelData &level_data)
+{
+    std::vector<LevelBlockInfo> level_blocks;
+    if (!ReadLevelDirectory(snapshot, level_blocks) || level >= level_blocks.size())
+        return false;
+    const LevelBlockInfo &level_block = level_blocks[level];
+    const Segment *seg = FindSegment(_snapshots[snapshot], static_cast<uint16_t>(level_block.Block.Index));
+    std::vector<uint8_t> data;
+    if (!seg || !ReadChunk(seg->Chunk, data))
+        return false;
+    level_data.LevelID = level_block.LevelID;
+    level_data.WorldID = level_block.WorldID;
+    DecodeLevelBlock(data.data(), std::min<size_t>(data.size(), level_block.Block.Size), level_block.Block, level_data);
+    return true;
+}
@@ -0,0 +1,169 @@
+//=============================================================================
+//
+// Save history pack: a series of LEVEL.ARK snapshots of the same game,
+// such as the consecutive autosaves of a player, stored in one file.
+//
+// Snapshots are nearly identical, so each archive is split into segments,
+// the header and one segment per used block, and every segment is stored
+// as a chunk of data relative to the same segment of the previous snapshot:
+// - unchanged segment refers to the chunk of the previous snapshot;
+// - changed segment is stored as a delta against the previous one, which
+//   keeps only the runs of bytes that differ, or in full if the delta does
+//   not pay off, or the chain of deltas grows too long.
+//
+// The pack ends with an index of all chunks and snapshots, which lets read
+// any level of any snapshot directly, reading only the header and the
+// level's block chunks with their delta bases.
+//
+// Pack layout (all values are little-endian):
+//
+// 0000   char[4]  signature "UWHP"
+// 0004   Int16    format version
+// 0006   Int16    game type
+// 0008   Int64    offset of the index
+// 0010   ...      chunk data
+//
+// Index:
+//        Int32    number of chunks, then per chunk:
+//          Int64  offset of the stored data
+//          Int32  size of the stored data
+//          Int32  size of the data, after applying the delta
+//          Int32  index of the delta base chunk, or -1 if stored in full
+//        Int32    number of snapshots, then per snapshot:
+//          Int32  archive length
+//          Int16  name length, followed by the name characters
+//          Int16  number of segments, then per segment, in file order:
+//            Int16  block index, or -1 for the header
+//            Int32  offset in the archive
+//            Int32  chunk index
+//
+//=============================================================================
+#ifndef UWSAV__HISTORY_H__
+#define UWSAV__HISTORY_H__
+
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include "uwsav/uwsav_data.h"
+
+// Writes snapshots into the history pack
+class HistoryPackWriter
+{
+public:
+    // Starts the pack in the output stream; if the game is unknown, it is
+    // detected by the first snapshot. The stream must be seekable and
+    // persist until the pack is finished.
+    HistoryPackWriter(Stream &out, GameType game = kGameUnknown);
+
+    // Adds the archive as the next snapshot; name is for the reference only,
+    // such as the archive's path. Returns false if the archive could not be
+    // read, or is not of the pack's game, or the output could not be written.
+    bool AddSnapshot(Stream &archive, const std::string &name);
+    // Writes the index; no snapshots may be added after this
+    bool Finish();
+
+    GameType GetGame() const { return _game; }
+    // Returns total length of the archives added
+    soff_t GetSourceSize() const { return _sourceSize; }
+
+private:
+    struct Chunk
+    {
+        soff_t Offset = 0;
+        uint32_t StoredSize = 0u;
+        uint32_t Size = 0u;
+        int32_t Base = -1;
+        uint32_t Depth = 0u; // length of the delta chain
+    };
+
+    struct Segment
+    {
+        uint16_t Block = 0u;
+        uint32_t Offset = 0u;
+        uint32_t Chunk = 0u;
+    };
+
+    struct Snapshot
+    {
+        std::string Name;
+        uint32_t Length = 0u;
+        std::vector<Segment> Segments;
+    };
+
+    // Stores the segment data, relative to the last snapshot's same segment;
+    // returns the chunk index
+    uint32_t StoreSegment(uint16_t block, const uint8_t *data, size_t size);
+
+    Stream &_out;
+    GameType _game;
+    bool _failed = false;
+    bool _finished = false;
+    soff_t _sourceSize = 0;
+    std::vector<Chunk> _chunks;
+    std::vector<Snapshot> _snapshots;
+    // Segments of the last snapshot, by block index
+    std::unordered_map<uint16_t, std::pair<uint32_t, std::vector<uint8_t>>> _last;
+    std::vector<uint8_t> _delta;
+};
+
+// Reads snapshots from the history pack
+class HistoryPackReader
+{
+public:
+    // Reads the pack index; the stream must persist while the pack is used
+    HistoryPackReader(Stream &in);
+
+    // Tells if the pack index was read successfully
+    bool IsValid() const { return _valid; }
+    GameType GetGame() const { return _game; }
+    size_t GetSnapshotCount() const { return _snapshots.size(); }
+    const std::string &GetSnapshotName(size_t snapshot) const { return _snapshots[snapshot].Name; }
+
+    // Restores the whole archive of the snapshot
+    bool ReadArchive(size_t snapshot, std::vector<uint8_t> &data);
+    // Reads level blocks of the snapshot's archive
+    bool ReadLevelDirectory(size_t snapshot, std::vector<LevelBlockInfo> &level_blocks);
+    // Reads one level of the snapshot, reading only the chunks it is made of;
+    // level is the index in the level directory
+    bool ReadLevel(size_t snapshot, size_t level, LevelData &level_data);
+
+private:
+    struct Chunk
+    {
+        soff_t Offset = 0;
+        uint32_t StoredSize = 0u;
+        uint32_t Size = 0u;
+        int32_t Base = -1;
+    };
+
+    struct Segment
+    {
+        uint16_t Block = 0u;
+        uint32_t Offset = 0u;
+        uint32_t Chunk = 0u;
+    };
+
+    struct Snapshot
+    {
+        std::string Name;
+        uint32_t Length = 0u;
+        std::vector<Segment> Segments;
+    };
+
+    // Reads the pack header and index
+    bool ReadIndex();
+    // Reads the chunk data, applying the chain of deltas
+    bool ReadChunk(uint32_t chunk, std::vector<uint8_t> &data);
+    // Finds the segment of the block; returns null if there's none
+    const Segment *FindSegment(const Snapshot &snap, uint16_t block) const;
+
+    Stream &_in;
+    bool _valid = false;
+    GameType _game = kGameUnknown;
+    std::vector<Chunk> _chunks;
+    std::vector<Snapshot> _snapshots;
+    std::vector<uint8_t> _stored; // last read stored chunk data
+    std::vector<uint8_t> _base;
+};
+
+#endif // UWSAV__HISTORY_H__
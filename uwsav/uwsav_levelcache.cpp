@@ -0,0 +1,89 @@
+#include "uwsav_levelcache.h"
+#include <algorithm>
+#include <string.h>
+
+LevelBlockKey LevelCache::MakeKey(const LevelBlockInfo &level_block, const uint8_t *data, size_t size)
+{
+    LevelBlockKey key;
+    key.Fingerprint = GetBlockFingerprint(data, size);
+    key.Size = static_cast<uint32_t>(size);
+    key.IsCompressed = level_block.Block.IsCompressed;
+    key.LevelID = level_block.LevelID;
+    key.WorldID = level_block.WorldID;
+    return key;
+}
+
+SharedLevel LevelCache::FindLevel(const EntryList &entries, const uint8_t *data, size_t size)
+{
+    for (const auto &entry : entries)
+    {
+        if (entry.Data.size() != size || (size > 0 && memcmp(entry.Data.data(), data, size) != 0))
+            continue;
+        SharedLevel level = entry.Level.lock();
+        if (level)
+            return level;
+    }
+    return nullptr;
+}
+
+SharedLevel LevelCache::GetOrDecode(const LevelBlockInfo &level_block, const uint8_t *data, size_t size)
+{
+    const LevelBlockKey key = MakeKey(level_block, data, size);
+    {
+        std::lock_guard<std::mutex> lk(_mutex);
+        auto it = _levels.find(key);
+        if (it != _levels.end())
+        {
+            SharedLevel level = FindLevel(it->second, data, size);
+            if (level)
+            {
+                _hits++;
+                return level;
+            }
+        }
+    }
+
+    std::shared_ptr<LevelData> level = std::make_shared<LevelData>();
+    level->LevelID = level_block.LevelID;
+    level->WorldID = level_block.WorldID;
+    DecodeLevelBlock(data, size, level_block.Block, *level);
+    Entry new_entry;
+    new_entry.Data.assign(data, data + size);
+    new_entry.Level = level;
+
+    std::lock_guard<std::mutex> lk(_mutex);
+    // Same level might have been decoded on another thread meanwhile;
+    // then the first one is kept, so that all users share it
+    EntryList &entries = _levels[key];
+    SharedLevel existing = FindLevel(entries, data, size);
+    if (existing)
+        return existing;
+    entries.push_back(std::move(new_entry));
+    if (++_entryCount >= _purgeSize)
+        PurgeExpired();
+    return level;
+}
+
+size_t LevelCache::GetHitCount() const
+{
+    std::lock_guard<std::mutex> lk(_mutex);
+    return _hits;
+}
+
+void LevelCache::PurgeExpired()
+{
+    _entryCount = 0u;
+    for (auto it = _levels.begin(); it != _levels.end();)
+    {
+        EntryList &entries = it->second;
+        entries.erase(std::remove_if(entries.begin(), entries.end(),
+            [](const Entry &entry) { return entry.Level.expired(); }), entries.end());
+        _entryCount += entries.size();
+        if (entries.empty())
+            it = _levels.erase(it);
+        else
+            ++it;
+    }
+    // Next purge when the cache doubles, so that the purge cost is amortized
+    _purgeSize = std::max<size_t>(64u, _entryCount * 2);
+}
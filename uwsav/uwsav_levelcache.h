@@ -0,0 +1,92 @@
+//=============================================================================
+//
+// Sharing of the levels decoded from identical blocks.
+//
+// Most levels in the save slots are byte-identical to the same levels in
+// other slots, as the player has not visited them since. The cache finds
+// such blocks by their fingerprint (see GetBlockFingerprint), confirms the
+// match by comparing the block data, and hands out one decoded LevelData
+// to all the archives they come from, instead of decoding a copy for each.
+//
+// Shared levels are immutable. The cache does not own them: a level stays
+// in the cache while any of its users holds it, so the cache never keeps
+// more levels than are in use already. It keeps a copy of each level's
+// block data along with it, which is small next to the decoded level.
+//
+// The cache is thread-safe; levels are decoded outside of its lock.
+//
+//=============================================================================
+#ifndef UWSAV__LEVELCACHE_H__
+#define UWSAV__LEVELCACHE_H__
+
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+#include "uwsav/uwsav_data.h"
+
+typedef std::shared_ptr<const LevelData> SharedLevel;
+
+// Identifies level block contents
+struct LevelBlockKey
+{
+    uint32_t Fingerprint = 0u; // of the block data, as stored in the archive
+    uint32_t Size = 0u;
+    bool IsCompressed = false;
+    uint8_t LevelID = 0u;
+    uint8_t WorldID = 0u;
+
+    bool operator ==(const LevelBlockKey &other) const
+    {
+        return Fingerprint == other.Fingerprint && Size == other.Size && IsCompressed == other.IsCompressed &&
+            LevelID == other.LevelID && WorldID == other.WorldID;
+    }
+};
+
+class LevelCache
+{
+public:
+    LevelCache() = default;
+
+    // Makes a key for the level block data
+    static LevelBlockKey MakeKey(const LevelBlockInfo &level_block, const uint8_t *data, size_t size);
+
+    // Returns the level decoded from the same block data, if there's one in use;
+    // otherwise decodes the level, and adds it to the cache
+    SharedLevel GetOrDecode(const LevelBlockInfo &level_block, const uint8_t *data, size_t size);
+
+    // Returns number of levels found in the cache, rather than decoded
+    size_t GetHitCount() const;
+
+private:
+    LevelCache(const LevelCache&) = delete;
+    LevelCache &operator=(const LevelCache&) = delete;
+
+    struct KeyHasher
+    {
+        size_t operator()(const LevelBlockKey &key) const { return key.Fingerprint; }
+    };
+
+    struct Entry
+    {
+        std::vector<uint8_t> Data; // block data the level was decoded from
+        std::weak_ptr<const LevelData> Level;
+    };
+    // Entries with the same key; there's more than one only if different
+    // block data happens to have the same fingerprint
+    typedef std::vector<Entry> EntryList;
+
+    // Returns the level decoded from the same block data, if it's in use
+    static SharedLevel FindLevel(const EntryList &entries, const uint8_t *data, size_t size);
+
+    // Removes entries of the levels no longer used
+    void PurgeExpired();
+
+    mutable std::mutex _mutex;
+    std::unordered_map<LevelBlockKey, EntryList, KeyHasher> _levels;
+    size_t _entryCount = 0u;
+    size_t _purgeSize = 64u; // purge expired entries when there are this many
+    size_t _hits = 0u;
+};
+
+#endif // UWSAV__LEVELCACHE_H__
@@ -0,0 +1,133 @@
+#include "uwsav_pipeline.h"
+#include <atomic>
+#include <exception>
+#include <thread>
+#include <vector>
+#include "utils/spscqueue.h"
+
+// Number of levels each stage may run ahead of the next one
+static const size_t StageQueueSize = 4u;
+
+// Level block read from the file
+struct PipelineBlock
+{
+    const LevelBlockInfo *LevelBlock = nullptr;
+    std::vector<uint8_t> Data;
+};
+
+// Adds the item to the queue, waits until there's free space, unless the
+// pipeline is stopped; returns false if it was stopped
+template <typename T>
+static bool PushUnlessStopped(SpscQueue<T> &queue, T &item, const std::atomic<bool> &stop)
+{
+    SpinBackoff backoff;
+    while (!queue.TryPush(item))
+    {
+        if (stop.load(std::memory_order_acquire))
+            return false;
+        backoff.Pause();
+    }
+    return true;
+}
+
+// Stops the stage threads and waits for them, when the pipeline is left,
+// whether it's done or the callback has thrown
+struct PipelineGuard
+{
+    std::atomic<bool> &Stop;
+    std::thread &Reader;
+    std::thread &Decoder;
+
+    ~PipelineGuard() { Join(); }
+
+    void Join()
+    {
+        Stop.store(true, std::memory_order_release);
+        if (Reader.joinable())
+            Reader.join();
+        if (Decoder.joinable())
+            Decoder.join();
+    }
+};
+
+void ForEachLevelPipelined(const std::shared_ptr<SharedFile> &file, GameType game,
+                           const LevelCallback &on_level)
+{
+    if (!file)
+        return;
+    std::vector<LevelBlockInfo> level_blocks;
+    {
+        Stream in(std::unique_ptr<StreamBase>(new SharedFileStream(file)));
+        ReadLevelDirectory(in, game, level_blocks);
+    }
+    if (level_blocks.empty())
+        return;
+
+    SpscQueue<PipelineBlock> read_queue(StageQueueSize);
+    SpscQueue<std::unique_ptr<LevelData>> decoded_queue(StageQueueSize);
+    // Stages stop early when any of them fails; the failure of a stage
+    // thread is passed to the calling thread
+    std::atomic<bool> stop { false };
+    std::exception_ptr reader_error, decoder_error;
+    std::thread reader, decoder;
+    PipelineGuard guard { stop, reader, decoder };
+
+    // Read stage
+    reader = std::thread([&file, &level_blocks, &read_queue, &stop, &reader_error]()
+    {
+        try
+        {
+            for (const auto &level_block : level_blocks)
+            {
+                PipelineBlock block;
+                block.LevelBlock = &level_block;
+                block.Data.resize(level_block.Block.Size);
+                block.Data.resize(file->ReadAt(block.Data.data(), block.Data.size(), level_block.Block.Offset));
+                if (!PushUnlessStopped(read_queue, block, stop))
+                    break;
+            }
+        }
+        catch (...)
+        {
+            reader_error = std::current_exception();
+            stop.store(true, std::memory_order_release);
+        }
+        read_queue.Close();
+    });
+
+    // Decode stage
+    decoder = std::thread([&read_queue, &decoded_queue, &stop, &decoder_error]()
+    {
+        try
+        {
+            PipelineBlock block;
+            while (!stop.load(std::memory_order_acquire) && read_queue.Pop(block))
+            {
+                std::unique_ptr<LevelData> level(new LevelData());
+                level->LevelID = block.LevelBlock->LevelID;
+                level->WorldID = block.LevelBlock->WorldID;
+                DecodeLevelBlock(block.Data.data(), block.Data.size(), block.LevelBlock->Block, *level);
+                if (!PushUnlessStopped(decoded_queue, level, stop))
+                    break;
+            }
+        }
+        catch (...)
+        {
+            decoder_error = std::current_exception();
+            stop.store(true, std::memory_order_release);
+        }
+        decoded_queue.Close();
+    });
+
+    // Format stage, on the calling thread; if the callback throws, the
+    // guard stops the other stages
+    std::unique_ptr<LevelData> level;
+    while (decoded_queue.Pop(level))
+        on_level(*level);
+
+    guard.Join();
+    if (reader_error)
+        std::rethrow_exception(reader_error);
+    if (decoder_error)
+        std::rethrow_exception(decoder_error);
+}
@@ -0,0 +1,27 @@
+//=============================================================================
+//
+// Pipelined reading of a single LEVEL.ARK.
+//
+// Levels pass three stages, each on its own thread: the level blocks are
+// read from the file, then decoded, and then passed to the callback. The
+// stages are connected with small bounded queues, so the next block is read
+// while the current one is decoded, and the previous one is printed; and
+// a stage which falls behind holds back the stages before it, which keeps
+// the memory use bounded. Levels reach the callback in the archive order.
+//
+//=============================================================================
+#ifndef UWSAV__PIPELINE_H__
+#define UWSAV__PIPELINE_H__
+
+#include <memory>
+#include "uwsav/uwsav_data.h"
+#include "utils/sharedfilestream.h"
+
+// Reads the archive level by level, and passes each one to the callback,
+// which is called on the calling thread. Each level is only valid until the
+// callback returns. If the callback, or reading or decoding on the stage
+// threads throws, the stages are stopped, and the exception is passed on.
+void ForEachLevelPipelined(const std::shared_ptr<SharedFile> &file, GameType game,
+                           const LevelCallback &on_level);
+
+#endif // UWSAV__PIPELINE_H__
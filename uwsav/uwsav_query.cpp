@@ -0,0 +1,84 @@
+#include "uwsav_query.h"
+#include <algorithm>
+
+void ObjectSpatialIndex::Build(const LevelData &level)
+{
+    const size_t tile_num = std::min<size_t>(level.tiles.size(), LevelData::Width * LevelData::Height);
+    _tileStart.assign(LevelData::Width * LevelData::Height + 1, 0u);
+    _objIndex.clear();
+    _x.clear();
+    _y.clear();
+
+    // Each object may be found only once; this also protects from the
+    // looped chains in the broken data
+    std::vector<bool> visited(level.objs.size());
+    for (size_t tile = 0; tile < tile_num; ++tile)
+    {
+        _tileStart[tile] = static_cast<uint16_t>(_objIndex.size());
+        const uint16_t tile_x = static_cast<uint16_t>(tile % LevelData::Width);
+        const uint16_t tile_y = static_cast<uint16_t>(tile / LevelData::Width);
+        for (uint16_t obj_index = level.tiles[tile].FirstObjLink;
+             obj_index > 0 && obj_index < level.objs.size() && !visited[obj_index];
+             obj_index = level.objs[obj_index].NextObjLink)
+        {
+            visited[obj_index] = true;
+            const ObjectData &obj = level.objs[obj_index];
+            _objIndex.push_back(obj_index);
+            _x.push_back(static_cast<uint16_t>(tile_x * TileUnits + obj.XPos));
+            _y.push_back(static_cast<uint16_t>(tile_y * TileUnits + obj.YPos));
+        }
+    }
+    std::fill(_tileStart.begin() + tile_num, _tileStart.end(), static_cast<uint16_t>(_objIndex.size()));
+}
+
+void ObjectSpatialIndex::QueryRadius(int x, int y, int radius, std::vector<ObjectLocation> &result) const
+{
+    if (_tileStart.empty() || radius < 0)
+        return;
+    // Radius larger than the level gives nothing more, and is limited so
+    // that its square does not overflow
+    radius = std::min<int>(radius, (LevelData::Width + LevelData::Height) * TileUnits);
+    // Circles outside of the level give empty tile ranges after clamping
+    const int tile_x0 = std::max(0, (x - radius) / TileUnits);
+    const int tile_y0 = std::max(0, (y - radius) / TileUnits);
+    const int tile_x1 = std::min<int>(LevelData::Width - 1, (x + radius) / TileUnits);
+    const int tile_y1 = std::min<int>(LevelData::Height - 1, (y + radius) / TileUnits);
+    if (tile_x0 > tile_x1 || tile_y0 > tile_y1)
+        return;
+    const int radius_sq = radius * radius;
+    for (int tile_y = tile_y0; tile_y <= tile_y1; ++tile_y)
+    {
+        // Tiles in a row are consecutive, and so are their objects
+        const size_t row = tile_y * LevelData::Width;
+        const size_t begin = _tileStart[row + tile_x0];
+        const size_t end = _tileStart[row + tile_x1 + 1];
+        for (size_t i = begin; i < end; ++i)
+        {
+            const int dx = _x[i] - x;
+            const int dy = _y[i] - y;
+            if (dx * dx + dy * dy <= radius_sq)
+                AddResult(i, result);
+        }
+    }
+}
+
+void ObjectSpatialIndex::QueryTiles(int tile_x0, int tile_y0, int tile_x1, int tile_y1,
+                                    std::vector<ObjectLocation> &result) const
+{
+    if (_tileStart.empty())
+        return;
+    tile_x0 = std::max(0, tile_x0);
+    tile_y0 = std::max(0, tile_y0);
+    tile_x1 = std::min<int>(LevelData::Width - 1, tile_x1);
+    tile_y1 = std::min<int>(LevelData::Height - 1, tile_y1);
+    if (tile_x0 > tile_x1)
+        return;
+    for (int tile_y = tile_y0; tile_y <= tile_y1; ++tile_y)
+    {
+        const size_t row = tile_y * LevelData::Width;
+        const size_t begin = _tileStart[row + tile_x0];
+        const size_t end = _tileStart[row + tile_x1 + 1];
+        for (size_t i = begin; i < end; ++i)
+            AddResult(i, result);
+    }
+}
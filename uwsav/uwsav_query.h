@@ -0,0 +1,72 @@
+//=============================================================================
+//
+// Spatial queries over the level's objects.
+//
+// Objects lying on the map are found through the tile object chains, which
+// start at TileData::FirstObjLink, and are grouped by tile into compact
+// position columns. Queries then visit only the tiles in range, instead of
+// scanning the whole master object list. Objects in containers or NPC
+// inventories have no position on the map, and are not included.
+//
+// Positions are given in the world units, which are 1/8 of a tile:
+// world x = tile x * 8 + object x position (0-7), and same for y.
+//
+//=============================================================================
+#ifndef UWSAV__QUERY_H__
+#define UWSAV__QUERY_H__
+
+#include <vector>
+#include "uwsav/uwsav_data.h"
+
+// Object found by a query
+struct ObjectLocation
+{
+    uint16_t ObjIndex = 0u; // index in the master object list
+    uint16_t X = 0u; // world position
+    uint16_t Y = 0u;
+};
+
+class ObjectSpatialIndex
+{
+public:
+    // Number of world units in a tile
+    static const int TileUnits = 8;
+
+    ObjectSpatialIndex() = default;
+    ObjectSpatialIndex(const LevelData &level) { Build(level); }
+
+    // Builds the index for the level
+    void    Build(const LevelData &level);
+
+    // Returns total number of objects lying on the map
+    size_t  GetObjectCount() const { return _objIndex.size(); }
+
+    // Finds objects within the radius of the world position, appends them
+    // to the result
+    void    QueryRadius(int x, int y, int radius, std::vector<ObjectLocation> &result) const;
+    // Finds objects lying in a rectangle of tiles (inclusive), appends them
+    // to the result
+    void    QueryTiles(int tile_x0, int tile_y0, int tile_x1, int tile_y1,
+                       std::vector<ObjectLocation> &result) const;
+
+private:
+    // Objects of each tile are stored in a row; tile's objects are found
+    // in [_tileStart[tile], _tileStart[tile + 1])
+    std::vector<uint16_t> _tileStart;
+    // Object columns
+    std::vector<uint16_t> _objIndex; // index in the master object list
+    std::vector<uint16_t> _x; // world position
+    std::vector<uint16_t> _y;
+
+    // Appends object at the given column row to the result
+    void    AddResult(size_t i, std::vector<ObjectLocation> &result) const
+    {
+        ObjectLocation loc;
+        loc.ObjIndex = _objIndex[i];
+        loc.X = _x[i];
+        loc.Y = _y[i];
+        result.push_back(loc);
+    }
+};
+
+#endif // UWSAV__QUERY_H__
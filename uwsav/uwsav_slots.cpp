@@ -0,0 +1,55 @@
+#include "uwsav_slots.h"
+#include <algorithm>
+
+bool GetAllocatedSlots(const LevelData &level, ObjectSlotSet &slots)
+{
+    slots.reset();
+    if (!level.HasFreeLists)
+        return false;
+    slots.set();
+    for (uint16_t slot : level.free_mobiles)
+    {
+        if (slot < LevelData::MaxMobiles)
+            slots.reset(slot);
+    }
+    for (uint16_t slot : level.free_statics)
+    {
+        if (slot >= LevelData::MaxMobiles && slot < LevelData::MaxObjects)
+            slots.reset(slot);
+    }
+    slots.reset(0);
+    slots.reset(1);
+    return true;
+}
+
+void GetLinkedSlots(const LevelData &level, const ObjectSlotSet &allocated, ObjectSlotSet &slots)
+{
+    slots.reset();
+    const size_t obj_num = std::min<size_t>(level.objs.size(), LevelData::MaxObjects);
+    for (const auto &tile : level.tiles)
+    {
+        if (tile.FirstObjLink > 0 && tile.FirstObjLink < obj_num)
+            slots.set(tile.FirstObjLink);
+    }
+    for (size_t obj_index = 0; obj_index < obj_num; ++obj_index)
+    {
+        if (!allocated.test(obj_index))
+            continue;
+        const ObjectData &obj = level.objs[obj_index];
+        if (obj.NextObjLink > 0 && obj.NextObjLink < obj_num)
+            slots.set(obj.NextObjLink);
+        // Link to contents, or to other related objects
+        if (!obj.IsQuantity && obj.SpecialLink > 0 && obj.SpecialLink < obj_num)
+            slots.set(obj.SpecialLink);
+    }
+}
+
+SlotCount CountSlots(const ObjectSlotSet &slots)
+{
+    // Mask of the mobile slots, which come first
+    static const ObjectSlotSet mobile_mask = ~ObjectSlotSet() >> LevelData::MaxStatic;
+    SlotCount count;
+    count.Mobile = (slots & mobile_mask).count();
+    count.Static = slots.count() - count.Mobile;
+    return count;
+}
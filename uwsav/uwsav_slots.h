@@ -0,0 +1,41 @@
+//=============================================================================
+//
+// Object slot occupancy.
+//
+// The level's master object list has 1024 slots; the game tracks which of
+// them are free with the free lists, stored in the level data. Slot sets
+// are bitsets of 1024 bits, so that counting slots is a popcount, and
+// comparing two sets is a few bitwise operations.
+//
+//=============================================================================
+#ifndef UWSAV__SLOTS_H__
+#define UWSAV__SLOTS_H__
+
+#include <bitset>
+#include "uwsav/uwsav_data.h"
+
+typedef std::bitset<LevelData::MaxObjects> ObjectSlotSet;
+
+// Number of slots in the set, separately for mobile and static objects
+struct SlotCount
+{
+    size_t Mobile = 0u;
+    size_t Static = 0u;
+
+    size_t Total() const { return Mobile + Static; }
+};
+
+// Fills the set of slots allocated for objects, which are the slots not
+// found in the free lists. Slot 0 means "no object", and slot 1 is reserved
+// for the player, so these are never included.
+// Returns false if the level has no free lists.
+bool GetAllocatedSlots(const LevelData &level, ObjectSlotSet &slots);
+// Fills the set of slots linked from the tiles, or from the allocated
+// objects, either as the next object in chain, or as contents. This is one
+// pass over the tiles and objects, without following the chains; an object
+// which is only linked from the leaked ones counts as linked.
+void GetLinkedSlots(const LevelData &level, const ObjectSlotSet &allocated, ObjectSlotSet &slots);
+// Counts slots in the set
+SlotCount CountSlots(const ObjectSlotSet &slots);
+
+#endif // UWSAV__SLOTS_H__
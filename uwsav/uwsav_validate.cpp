@@ -0,0 +1,148 @@
+#include "uwsav_validate.h"
+#include <algorithm>
+#include "uwsav_slots.h"
+
+namespace
+{
+
+class GraphValidator
+{
+public:
+    GraphValidator(const LevelData &level, std::vector<GraphIssue> &issues)
+        : _level(level)
+        , _issues(issues)
+        , _objNum(std::min<size_t>(level.objs.size(), LevelData::MaxObjects))
+        , _parent(_objNum)
+    {
+        _hasFreeLists = GetAllocatedSlots(level, _allocated);
+        _path.reserve(_objNum);
+    }
+
+    void Run()
+    {
+        const size_t tile_num = _level.tiles.size();
+        for (size_t tile = 0; tile < tile_num; ++tile)
+        {
+            ObjectLink link;
+            link.Kind = kLinkTile;
+            link.Source = static_cast<uint16_t>(tile);
+            Follow(link, _level.tiles[tile].FirstObjLink);
+            Walk();
+        }
+
+        if (!_hasFreeLists)
+            return;
+        const ObjectSlotSet leaked = _allocated & ~_visited;
+        for (size_t slot = 0; slot < leaked.size(); ++slot)
+        {
+            if (leaked.test(slot))
+                AddIssue(kIssueLeakedSlot, ObjectLink(), static_cast<uint16_t>(slot));
+        }
+    }
+
+private:
+    // Walk stages of an object on the path
+    enum Stage
+    {
+        kStageSpecial,  // SpecialLink is next to follow
+        kStageNext,     // NextObjLink is next to follow
+        kStageDone
+    };
+
+    struct PathEntry
+    {
+        uint16_t Obj;
+        uint8_t  Stage;
+    };
+
+    // Checks the link, and puts the linked object on the path if it was
+    // not reached before
+    void Follow(const ObjectLink &link, uint16_t target)
+    {
+        if (target == 0)
+            return;
+        if (target >= _objNum)
+        {
+            AddIssue(kIssueOutOfRange, link, target);
+            return;
+        }
+        // Free slots contain stale data, which is not followed;
+        // slot 1 is reserved for the player and is never in the free lists
+        if (_hasFreeLists && target > 1 && !_allocated.test(target))
+        {
+            AddIssue(kIssueFreeSlot, link, target);
+            return;
+        }
+        if (_visited.test(target))
+        {
+            AddIssue(_done.test(target) ? kIssueSharedObject : kIssueLoop, link, target);
+            return;
+        }
+        _visited.set(target);
+        _parent[target] = link;
+        _path.push_back(PathEntry{ target, kStageSpecial });
+    }
+
+    // Walks the graph depth-first, until the path is empty
+    void Walk()
+    {
+        while (!_path.empty())
+        {
+            PathEntry &top = _path.back();
+            const uint16_t obj_index = top.Obj;
+            const ObjectData &obj = _level.objs[obj_index];
+            ObjectLink link;
+            link.Source = obj_index;
+            switch (top.Stage)
+            {
+            case kStageSpecial:
+                top.Stage = kStageNext;
+                // Quantity objects use SpecialLink for a number instead
+                link.Kind = kLinkSpecial;
+                if (!obj.IsQuantity)
+                    Follow(link, obj.SpecialLink);
+                break;
+            case kStageNext:
+                top.Stage = kStageDone;
+                link.Kind = kLinkNext;
+                Follow(link, obj.NextObjLink);
+                break;
+            default:
+                _done.set(obj_index);
+                _path.pop_back();
+                break;
+            }
+        }
+    }
+
+    void AddIssue(GraphIssueKind kind, const ObjectLink &link, uint16_t target)
+    {
+        GraphIssue issue;
+        issue.Kind = kind;
+        issue.Link = link;
+        issue.Target = target;
+        if (target < _objNum)
+            issue.Parent = _parent[target];
+        _issues.push_back(issue);
+    }
+
+    const LevelData &_level;
+    std::vector<GraphIssue> &_issues;
+    const size_t _objNum;
+    bool _hasFreeLists = false;
+    ObjectSlotSet _allocated;
+    // Objects reached by the walk; objects done have their whole chain
+    // and contents walked, the rest of the reached are still on the path
+    ObjectSlotSet _visited;
+    ObjectSlotSet _done;
+    // First link to each reached object
+    std::vector<ObjectLink> _parent;
+    std::vector<PathEntry> _path;
+};
+
+} // namespace
+
+void ValidateObjectGraph(const LevelData &level, std::vector<GraphIssue> &issues)
+{
+    GraphValidator(level, issues).Run();
+}
@@ -0,0 +1,59 @@
+//=============================================================================
+//
+// Object graph validation.
+//
+// Level objects form a graph: each tile starts an object chain with its
+// FirstObjLink, objects continue the chain with NextObjLink, and containers
+// and NPCs start the chain of their contents with SpecialLink. In the
+// correct data every object is linked exactly once, and the chains have
+// no loops.
+//
+// The validator walks the whole graph once, visiting each tile and each
+// object slot at most one time, and remembers for every reached object
+// the link by which it was reached first. Any further link to an already
+// reached object is either a loop, if that object is still on the current
+// walk path, or a second parent otherwise.
+//
+//=============================================================================
+#ifndef UWSAV__VALIDATE_H__
+#define UWSAV__VALIDATE_H__
+
+#include <vector>
+#include "uwsav/uwsav_data.h"
+
+enum ObjectLinkKind
+{
+    kLinkNone,
+    kLinkTile,      // TileData::FirstObjLink
+    kLinkNext,      // ObjectData::NextObjLink
+    kLinkSpecial    // ObjectData::SpecialLink
+};
+
+// Location of a link in the level data
+struct ObjectLink
+{
+    ObjectLinkKind Kind = kLinkNone;
+    uint16_t Source = 0u; // tile index for the tile links, object index otherwise
+};
+
+enum GraphIssueKind
+{
+    kIssueOutOfRange,   // link to the index past the object list
+    kIssueFreeSlot,     // link to the slot found in the free lists
+    kIssueLoop,         // link back to the object on the same chain path
+    kIssueSharedObject, // link to the object already linked from elsewhere
+    kIssueLeakedSlot    // allocated slot not reachable from any tile
+};
+
+struct GraphIssue
+{
+    GraphIssueKind Kind = kIssueOutOfRange;
+    ObjectLink Link;    // the offending link; none for the leaked slots
+    uint16_t Target = 0u; // linked object index, or the leaked slot
+    ObjectLink Parent;  // link by which the target was reached first, if any
+};
+
+// Checks the level's object graph, appends all the found issues
+void ValidateObjectGraph(const LevelData &level, std::vector<GraphIssue> &issues);
+
+#endif // UWSAV__VALIDATE_H__
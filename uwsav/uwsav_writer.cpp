@@ -0,0 +1,172 @@
+#include "uwsav_writer.h"
+#include <algorithm>
+
+// Size of the buffer for copying the unmodified data
+static const size_t CopyBufferSize = 64u * 1024u;
+// Block flag telling that the block has available space after its data
+static const uint32_t AvailSpaceFlag = 0x4;
+
+// Copies a range of the source stream into the output
+static bool CopyRange(Stream &src, soff_t offset, soff_t size, Stream &out, std::vector<uint8_t> &buf)
+{
+    if (size <= 0)
+        return true;
+    if (!src.Seek(offset, kSeekBegin))
+        return false;
+    buf.resize(CopyBufferSize);
+    while (size > 0)
+    {
+        const size_t n = static_cast<size_t>(std::min<soff_t>(size, buf.size()));
+        if (src.Read(buf.data(), n) != n || out.Write(buf.data(), n) != n)
+            return false;
+        size -= n;
+    }
+    return true;
+}
+
+// Writes number of zero bytes into the output
+static bool WriteZeros(Stream &out, size_t size, std::vector<uint8_t> &buf)
+{
+    buf.assign(std::min(size, CopyBufferSize), 0u);
+    while (size > 0)
+    {
+        const size_t n = std::min(size, buf.size());
+        if (out.Write(buf.data(), n) != n)
+            return false;
+        size -= n;
+    }
+    return true;
+}
+
+// Reads the modified level's block, packs the level over it, and compresses
+// it again if the block was compressed
+static bool PackModifiedLevel(Stream &src, const DataBlockInfo &block, const LevelData &level,
+                              int compress_level, std::vector<uint8_t> &data)
+{
+    std::vector<uint8_t> raw(block.Size);
+    src.Seek(block.Offset, kSeekBegin);
+    raw.resize(src.Read(raw.data(), raw.size()));
+    if (!block.IsCompressed)
+    {
+        if (!PackLevelBlock(level, raw.data(), raw.size()))
+            return false;
+        data.swap(raw);
+        return true;
+    }
+
+    std::vector<uint8_t> unpacked;
+    UncompressUW2Block(raw.data(), raw.size(), unpacked);
+    if (!PackLevelBlock(level, unpacked.data(), unpacked.size()))
+        return false;
+    return CompressUW2Block(unpacked.data(), unpacked.size(), data, compress_level);
+}
+
+bool WriteArchive(Stream &src, GameType game, const std::vector<LevelData> &levels,
+                  const std::vector<bool> &modified, Stream &out, int compress_level)
+{
+    if (!src || !out)
+        return false;
+    if (game == kGameUnknown && !DetectGameType(src, game))
+        return false;
+    std::vector<ArchiveBlockInfo> arc_blocks;
+    std::vector<LevelBlockInfo> level_blocks;
+    ReadArchiveDirectory(src, game, arc_blocks);
+    ReadLevelDirectory(src, game, level_blocks);
+    if (arc_blocks.empty() || levels.size() != level_blocks.size() || modified.size() != levels.size())
+        return false;
+
+    // Pack the modified levels first, as their new sizes define the layout
+    const size_t num_blocks = arc_blocks.size();
+    std::vector<std::vector<uint8_t>> new_data(num_blocks);
+    std::vector<bool> is_new(num_blocks);
+    for (size_t i = 0; i < levels.size(); ++i)
+    {
+        if (!modified[i])
+            continue;
+        const DataBlockInfo &block = level_blocks[i].Block;
+        if (!PackModifiedLevel(src, block, levels[i], compress_level, new_data[block.Index]))
+            return false;
+        is_new[block.Index] = true;
+    }
+
+    // Used blocks, in the order of the file
+    std::vector<DataBlockInfo> blocks(num_blocks);
+    std::vector<size_t> order;
+    for (size_t i = 0; i < num_blocks; ++i)
+    {
+        blocks[i] = arc_blocks[i].Block;
+        if (blocks[i].Offset > 0)
+            order.push_back(i);
+    }
+    std::stable_sort(order.begin(), order.end(),
+        [&blocks](size_t a, size_t b) { return blocks[a].Offset < blocks[b].Offset; });
+
+    // Source range of each block: its data and the available space after it,
+    // limited by the next block and the end of file
+    const soff_t src_len = src.GetLength();
+    std::vector<soff_t> src_extent(num_blocks);
+    for (size_t k = 0; k < order.size(); ++k)
+    {
+        const DataBlockInfo &block = blocks[order[k]];
+        const soff_t next = (k + 1 < order.size()) ? blocks[order[k + 1]].Offset : src_len;
+        const soff_t extent = static_cast<soff_t>(block.Size) + block.AvailSpace;
+        src_extent[order[k]] = std::max<soff_t>(0, std::min<soff_t>(extent, next - block.Offset));
+    }
+
+    // Lay out the blocks; a modified block takes at least the space of the
+    // original one, and the rest of that space becomes its available space
+    std::vector<soff_t> extent(src_extent);
+    soff_t pos = GetArchiveHeaderSize(game, static_cast<uint16_t>(num_blocks));
+    for (size_t i : order)
+    {
+        DataBlockInfo &block = blocks[i];
+        if (is_new[i])
+        {
+            const soff_t size = new_data[i].size();
+            const soff_t avail = std::max<soff_t>(0, src_extent[i] - size);
+            block.Size = static_cast<uint32_t>(size);
+            block.AvailSpace = static_cast<uint32_t>(avail);
+            block.HasAvailSpace = avail > 0;
+            block.Flags = (block.Flags & ~AvailSpaceFlag) | (avail > 0 ? AvailSpaceFlag : 0u);
+            extent[i] = size + avail;
+        }
+        block.Offset = static_cast<uint32_t>(pos);
+        pos += extent[i];
+    }
+
+    // The header: number of blocks and extras are copied, the tables are written anew
+    std::vector<uint8_t> buf;
+    if (!CopyRange(src, 0, GetArchiveHeaderSize(game, 0), out, buf))
+        return false;
+    WriteBlockDirectory(out, game, blocks);
+
+    // Block data; runs of unmodified blocks which follow each other in the
+    // source are copied at once
+    soff_t copy_start = 0;
+    soff_t copy_size = 0;
+    for (size_t i : order)
+    {
+        const soff_t src_offset = arc_blocks[i].Block.Offset;
+        if (!is_new[i])
+        {
+            if (copy_start + copy_size != src_offset)
+            {
+                if (!CopyRange(src, copy_start, copy_size, out, buf))
+                    return false;
+                copy_start = src_offset;
+                copy_size = 0;
+            }
+            copy_size += extent[i];
+            continue;
+        }
+
+        if (!CopyRange(src, copy_start, copy_size, out, buf))
+            return false;
+        copy_size = 0;
+        const std::vector<uint8_t> &data = new_data[i];
+        if (out.Write(data.data(), data.size()) != data.size() ||
+            !WriteZeros(out, static_cast<size_t>(extent[i] - data.size()), buf))
+            return false;
+    }
+    return CopyRange(src, copy_start, copy_size, out, buf);
+}
@@ -0,0 +1,35 @@
+//=============================================================================
+//
+// Writing of the modified LEVEL.ARK.
+//
+// The archive is written from the original file and the levels read from
+// it, where only the levels marked as modified are packed and compressed
+// anew; all the other blocks are copied from the original file as they are.
+// Modified levels are packed over their original block data, so that the
+// fields not decoded into LevelData are kept.
+//
+// Blocks keep their order in the file. A modified block is written in
+// place of the original if it fits into the original block with its
+// available space, which then keeps all the following blocks in place;
+// otherwise the following blocks are moved.
+//
+//=============================================================================
+#ifndef UWSAV__WRITER_H__
+#define UWSAV__WRITER_H__
+
+#include <vector>
+#include "uwsav/uwsav_compress.h"
+#include "uwsav/uwsav_data.h"
+
+// Writes the archive read from the source stream into the output stream,
+// replacing the modified levels. Levels must be in the same order as read
+// by ReadLevels from the same source; modified tells which of them to
+// write, in the same order. Compressed levels are compressed again with
+// the given level, see UW2BlockEncoder.
+// Returns false if the source could not be read, or any of the modified
+// levels could not be packed, or the output could not be written.
+bool WriteArchive(Stream &src, GameType game, const std::vector<LevelData> &levels,
+                  const std::vector<bool> &modified, Stream &out,
+                  int compress_level = UW2BlockEncoder::DefaultLevel);
+
+#endif // UWSAV__WRITER_H__